@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2014 Bert Vermeulen <bert@biot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host-side benchmark: feeds synthetic workloads and recorded keystroke
+ * streams through tl_input() and reports throughput.
+ *
+ * Usage: tokenline-bench [-b | -r] [-t seconds] [-w workload] [file...]
+ *   -b  feed input with tl_input_buf() instead of tl_input()
+ *   -r  feed input with tl_rx_push(), draining it with tl_poll()
+ *   -t  minimum run time per workload, default 0.5s
+ *   -w  only run the named workload
+ * Each file is replayed as a workload of its own, against the bench
+ * command tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tokenline.h"
+
+#define NUM_KEYWORDS  160
+#define DEEP_LEVELS   (TL_MAX_TOKEN_DEPTH - 1)
+#define MAX_STREAM    (256 * 1024)
+#define CHUNK_SIZE    64
+#define CLEAR_LINE    "\x01\x0b"
+#define KEY_UP        "\x1b[A"
+#define KEY_DOWN      "\x1b[B"
+
+enum {
+	INPUT_CHAR,
+	INPUT_BUF,
+	INPUT_RING,
+};
+
+static const char *input_names[] = {
+	"tl_input", "tl_input_buf", "tl_rx_push/tl_poll",
+};
+
+enum {
+	T_BUS = 1,
+	T_DEEP,
+	T_OPEN,
+	T_CLOSE,
+	T_OPEN_CS,
+	T_CLOSE_CS,
+	T_READ,
+	T_WRITE,
+	T_DELAY,
+	T_DELAY_US,
+	T_CLK_UP,
+	T_PULL_UP,
+	T_PULL_DOWN,
+	T_SET,
+	T_SPEED,
+	T_NAME,
+	T_LEVEL,
+	T_KEYWORD = T_LEVEL + DEEP_LEVELS,
+	T_END = T_KEYWORD + NUM_KEYWORDS,
+};
+
+static t_token_dict dict[T_END + 1] = {
+	{ /* Dummy entry */ },
+	{ T_BUS, "bus" },
+	{ T_DEEP, "deep" },
+	{ T_OPEN, "[" },
+	{ T_CLOSE, "]" },
+	{ T_OPEN_CS, "{" },
+	{ T_CLOSE_CS, "}" },
+	{ T_READ, "r" },
+	{ T_WRITE, "w" },
+	{ T_DELAY, "&" },
+	{ T_DELAY_US, "%" },
+	{ T_CLK_UP, "/" },
+	{ T_PULL_UP, "pull-up" },
+	{ T_PULL_DOWN, "pull-down" },
+	{ T_SET, "set" },
+	{ T_SPEED, "speed" },
+	{ T_NAME, "name" },
+};
+static char keyword_str[DEEP_LEVELS + NUM_KEYWORDS][8];
+
+static t_token tokens_bus[] = {
+	{ T_OPEN },
+	{ T_CLOSE },
+	{ T_OPEN_CS },
+	{ T_CLOSE_CS },
+	{ T_READ,
+		.flags = T_FLAG_SUFFIX_TOKEN_DELIM_INT },
+	{ T_WRITE,
+		.flags = T_FLAG_SUFFIX_TOKEN_DELIM_INT },
+	{ T_DELAY,
+		.flags = T_FLAG_SUFFIX_TOKEN_DELIM_INT },
+	{ T_DELAY_US,
+		.flags = T_FLAG_SUFFIX_TOKEN_DELIM_INT },
+	{ T_CLK_UP },
+	{ T_PULL_UP },
+	{ T_PULL_DOWN },
+	{ T_ARG_UINT },
+	{ }
+};
+
+static t_token tokens_set[] = {
+	{ T_SPEED,
+		.arg_type = T_ARG_FLOAT,
+		.help = "Bus speed" },
+	{ T_NAME,
+		.arg_type = T_ARG_STRING,
+		.help = "Bus name" },
+	{ }
+};
+
+/* A chain of single-entry tables, DEEP_LEVELS deep. */
+static t_token tokens_deep[DEEP_LEVELS][2];
+
+static t_token tokens[4 + NUM_KEYWORDS + 1] = {
+	{ T_BUS,
+		.subtokens = tokens_bus,
+		.help = "Bus sequence" },
+	{ T_SET,
+		.subtokens = tokens_set,
+		.help = "Set bus parameters" },
+	{ T_DEEP,
+		.subtokens = tokens_deep[0],
+		.help = "Deep command tree" },
+	{ T_ARG_HELP,
+		.help = "Help" },
+};
+
+struct stream {
+	const char *name;
+	char *buf;
+	size_t len;
+	int lines;
+};
+
+struct counters {
+	unsigned long print_calls;
+	unsigned long print_bytes;
+	unsigned long callbacks;
+};
+
+static struct counters counters;
+TL_DEFINE_INDEX(token_index, TL_MAX_INDEX_TABLES, TL_MAX_INDEX_ENTRIES,
+		TL_MAX_INDEX_KEYWORDS, TL_MAX_INDEX_SPECIAL);
+
+static void bench_print(void *user, const char *str)
+{
+	(void)user;
+
+	counters.print_calls++;
+	counters.print_bytes += strlen(str);
+}
+
+static void bench_callback(void *user, t_tokenline_parsed *p)
+{
+	(void)user;
+	(void)p;
+
+	counters.callbacks++;
+}
+
+static void tables_init(void)
+{
+	int i, t;
+
+	for (i = 0; i < DEEP_LEVELS; i++) {
+		t = T_LEVEL + i;
+		sprintf(keyword_str[i], "level%d", i + 1);
+		dict[t].token = t;
+		dict[t].tokenstr = keyword_str[i];
+		tokens_deep[i][0].token = t;
+		tokens_deep[i][0].help = "Level";
+		if (i < DEEP_LEVELS - 1)
+			tokens_deep[i][0].subtokens = tokens_deep[i + 1];
+		else
+			tokens_deep[i][0].arg_type = T_ARG_UINT;
+	}
+
+	for (i = 0; i < NUM_KEYWORDS; i++) {
+		t = T_KEYWORD + i;
+		sprintf(keyword_str[DEEP_LEVELS + i], "kw%03d", i);
+		dict[t].token = t;
+		dict[t].tokenstr = keyword_str[DEEP_LEVELS + i];
+		tokens[3 + i].token = t;
+		tokens[3 + i].help = "Keyword";
+	}
+	tokens[3 + NUM_KEYWORDS].token = T_ARG_HELP;
+	tokens[3 + NUM_KEYWORDS].help = "Help";
+
+	tl_index_init(&token_index, dict);
+	if (!tl_index_add(&token_index, tokens)) {
+		fprintf(stderr, "index too small for bench tables\n");
+		exit(1);
+	}
+}
+
+static void stream_init(struct stream *s, const char *name)
+{
+	s->name = name;
+	s->buf = malloc(MAX_STREAM);
+	s->len = 0;
+	s->lines = 0;
+}
+
+static void stream_add(struct stream *s, const char *str)
+{
+	size_t len;
+
+	len = strlen(str);
+	if (s->len + len > MAX_STREAM) {
+		fprintf(stderr, "%s: stream too long\n", s->name);
+		exit(1);
+	}
+	memcpy(s->buf + s->len, str, len);
+	s->len += len;
+}
+
+static void stream_line(struct stream *s, const char *str)
+{
+	stream_add(s, str);
+	stream_add(s, "\r");
+	s->lines++;
+}
+
+/* Long bus sequence lines split on special characters. */
+static void gen_special(struct stream *s)
+{
+	char line[TL_MAX_LINE_LEN];
+	int i;
+
+	for (i = 0; i < 200; i++) {
+		snprintf(line, sizeof(line), "bus [0x%02x r:%d 0x%02x]{0x%02x w:2 %%:10 &}"
+				"/pull-up [r:4]&:%d pull-down{%d}", i & 0xff, i % 16 + 2,
+				(i * 7) & 0xff, (i * 13) & 0xff, i % 9 + 2, i);
+		stream_line(s, line);
+	}
+}
+
+/* Full paths down the deepest tree the tokenizer allows. */
+static void gen_deep(struct stream *s)
+{
+	char line[TL_MAX_LINE_LEN];
+	int i, j, len;
+
+	for (i = 0; i < 200; i++) {
+		len = snprintf(line, sizeof(line), "deep");
+		for (j = 0; j < DEEP_LEVELS; j++)
+			len += snprintf(line + len, sizeof(line) - len, " level%d", j + 1);
+		snprintf(line + len, sizeof(line) - len, " %d", i);
+		stream_line(s, line);
+	}
+}
+
+/* Many words looked up in one large table. */
+static void gen_dict(struct stream *s)
+{
+	char line[TL_MAX_LINE_LEN];
+	int i, j, len;
+
+	srand(1);
+	for (i = 0; i < 200; i++) {
+		len = 0;
+		for (j = 0; j < 16; j++)
+			len += snprintf(line + len, sizeof(line) - len, "%skw%03d",
+					j ? " " : "", rand() % NUM_KEYWORDS);
+		stream_line(s, line);
+	}
+}
+
+/* Distinct lines overflowing the history, walked back with the arrows. */
+static void gen_history(struct stream *s)
+{
+	char line[TL_MAX_LINE_LEN];
+	int i, j;
+
+	for (i = 0; i < 400; i++) {
+		snprintf(line, sizeof(line), "set name \"history entry %d\"", i);
+		stream_line(s, line);
+		if (i % 8 == 7) {
+			for (j = 0; j < 40; j++)
+				stream_add(s, KEY_UP);
+			for (j = 0; j < 40; j++)
+				stream_add(s, KEY_DOWN);
+			stream_add(s, CLEAR_LINE);
+		}
+	}
+}
+
+/* Tab completion of partial words, unique and ambiguous. */
+static void gen_tab(struct stream *s)
+{
+	int i;
+
+	for (i = 0; i < 200; i++) {
+		/* Unique completions, one level at a time. */
+		stream_add(s, "de\tl\tl\tl\tl\tl\tl\tl\t");
+		stream_add(s, CLEAR_LINE);
+		/* Ambiguous, lists candidates. */
+		stream_add(s, "kw1\t\t");
+		stream_add(s, CLEAR_LINE);
+		stream_add(s, "bus [0x55 r:2] pu\t\t-\t");
+		stream_add(s, CLEAR_LINE);
+		stream_add(s, "set \t");
+		stream_add(s, CLEAR_LINE);
+		s->lines++;
+	}
+}
+
+#if TL_MAX_ALIASES
+/* Bus sequences run through an alias, from its cache after the first run. */
+static void gen_alias(struct stream *s)
+{
+	int i;
+
+	stream_line(s, "alias seq \"bus [0x55 r:4 0x10]{0x20 w:2 %:10 &}; bus [r:2]\"");
+	for (i = 0; i < 400; i++)
+		stream_line(s, "seq");
+}
+#endif
+
+static int stream_load(struct stream *s, const char *path)
+{
+	FILE *f;
+	size_t i;
+
+	if (!(f = fopen(path, "rb"))) {
+		perror(path);
+		return FALSE;
+	}
+	stream_init(s, path);
+	s->len = fread(s->buf, 1, MAX_STREAM, f);
+	fclose(f);
+	s->lines = 0;
+	for (i = 0; i < s->len; i++)
+		if (s->buf[i] == '\r' || s->buf[i] == '\n')
+			s->lines++;
+
+	return TRUE;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void feed(t_tokenline *tl, struct stream *s, int input)
+{
+	size_t i, len;
+
+	if (input == INPUT_BUF) {
+		for (i = 0; i < s->len; i += len) {
+			len = s->len - i < CHUNK_SIZE ? s->len - i : CHUNK_SIZE;
+			tl_input_buf(tl, (uint8_t *)s->buf + i, len, NULL);
+		}
+	} else if (input == INPUT_RING) {
+		/* As if an interrupt filled the ring between polls. */
+		for (i = 0; i < s->len; i++) {
+			if (!tl_rx_push(tl, s->buf[i])) {
+				tl_poll(tl);
+				tl_rx_push(tl, s->buf[i]);
+			}
+		}
+		tl_poll(tl);
+	} else {
+		for (i = 0; i < s->len; i++)
+			tl_input(tl, s->buf[i]);
+	}
+}
+
+static void run(struct stream *s, int use_index, int input, double min_time)
+{
+	t_tokenline tl;
+	double start, elapsed;
+	unsigned long passes, keys, lines;
+
+	tl_init(&tl, tokens, dict, bench_print, NULL);
+	if (use_index)
+		tl_set_index(&tl, &token_index);
+	tl_set_prompt(&tl, "bench> ");
+	tl_set_callback(&tl, bench_callback);
+
+	/* Warm up, then measure from a clean slate. */
+	feed(&tl, s, input);
+	memset(&counters, 0, sizeof(counters));
+	passes = 0;
+	start = now();
+	do {
+		feed(&tl, s, input);
+		passes++;
+		elapsed = now() - start;
+	} while (elapsed < min_time);
+
+	keys = passes * s->len;
+	lines = passes * s->lines;
+	printf("%-10s %-6s %12.0f %10.1f %10.1f %10.1f %8lu\n", s->name,
+			use_index ? "index" : "scan", lines / elapsed,
+			elapsed * 1e9 / keys, (double)counters.print_bytes / keys,
+			lines ? (double)counters.print_bytes / lines : 0.0,
+			counters.callbacks / passes);
+}
+
+int main(int argc, char **argv)
+{
+	struct stream streams[16];
+	const char *only;
+	double min_time;
+	int num_streams, input, i, j;
+
+	input = INPUT_CHAR;
+	min_time = 0.5;
+	only = NULL;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-b")) {
+			input = INPUT_BUF;
+		} else if (!strcmp(argv[i], "-r")) {
+			input = INPUT_RING;
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			min_time = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			only = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [-b | -r] [-t seconds] [-w workload] [file...]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+
+	tables_init();
+	num_streams = 0;
+	stream_init(&streams[num_streams], "special");
+	gen_special(&streams[num_streams++]);
+	stream_init(&streams[num_streams], "deep");
+	gen_deep(&streams[num_streams++]);
+	stream_init(&streams[num_streams], "dict");
+	gen_dict(&streams[num_streams++]);
+	stream_init(&streams[num_streams], "history");
+	gen_history(&streams[num_streams++]);
+	stream_init(&streams[num_streams], "tab");
+	gen_tab(&streams[num_streams++]);
+#if TL_MAX_ALIASES
+	stream_init(&streams[num_streams], "alias");
+	gen_alias(&streams[num_streams++]);
+#endif
+	for (; i < argc && num_streams < 16; i++) {
+		if (!stream_load(&streams[num_streams], argv[i]))
+			return 1;
+		num_streams++;
+	}
+
+	printf("input: %s\n", input_names[input]);
+	printf("%-10s %-6s %12s %10s %10s %10s %8s\n", "workload", "lookup",
+			"lines/s", "ns/key", "out/key", "out/line", "calls");
+	for (i = 0; i < num_streams; i++) {
+		if (!only || !strcmp(only, streams[i].name))
+			for (j = 0; j < 2; j++)
+				run(&streams[i], j, input, min_time);
+		free(streams[i].buf);
+	}
+
+	return 0;
+}
@@ -15,19 +15,19 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <termios.h>
+#ifdef TL_PROFILE
+#include <time.h>
+#endif
 #include "commands.h"
 
 #include "tokenline.h"
 
-extern t_token tokens[];
-extern t_token_dict dict[];
-extern t_token tokens_mode_device[];
-extern t_token tokens_mode_calc[];
-
 enum {
 	MODE_TOP,
 	MODE_DEVICE,
@@ -46,31 +46,63 @@ void print(void *user, const char *str)
 	printf("%s", str);
 }
 
+#ifdef TL_PROFILE
+/* Stands in for a hardware cycle counter: nanoseconds. */
+static uint32_t cycles(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+/* Handler for "led", called instead of dump_parsed(). */
+void cmd_led(void *user, t_tokenline_parsed *p)
+{
+	(void)user;
+
+	printf("LED is %s\n", p->tokens[1] == T_ON ? "on" : "off");
+}
+
 static void dump_parsed(void *user, t_tokenline_parsed *p)
 {
 	struct demo_context *ctx;
-	float arg_float;
-	uint32_t arg_uint;
-	int arg_int, i;
+	int i;
 
 	ctx = user;
 	for (i = 0; p->tokens[i]; i++) {
 		printf("%d: ", i);
 		switch (p->tokens[i]) {
 		case T_ARG_UINT:
-			memcpy(&arg_int, p->buf + p->tokens[++i], sizeof(int));
-			printf("integer %d\n", arg_int);
+			printf("integer %d\n", TL_ARG_UINT(p, i));
+			i++;
+			break;
+		case T_ARG_UINT64:
+			printf("64-bit integer %" PRIu64 "\n", TL_ARG_UINT64(p, i));
+			i++;
+			break;
+		case T_ARG_INT:
+			printf("signed integer %" PRId32 "\n", TL_ARG_INT(p, i));
+			i++;
 			break;
 		case T_ARG_FLOAT:
-			memcpy(&arg_float, p->buf + p->tokens[++i], sizeof(float));
-			printf("float %f\n", arg_float);
+			printf("float %f\n", TL_ARG_FLOAT(p, i));
+			i++;
+			break;
+		case T_ARG_FIXED:
+			printf("fixed %f\n", (double)TL_ARG_FIXED(p, i) / TL_FIXED_ONE);
+			i++;
 			break;
 		case T_ARG_STRING:
-			printf("string '%s'\n", p->buf + p->tokens[++i]);
+			printf("string '%.*s'\n", TL_ARG_STRING_LEN(p, i),
+					TL_ARG_STRING(p, i));
+			i++;
 			break;
 		case T_ARG_TOKEN_SUFFIX_INT:
-			memcpy(&arg_uint, p->buf + p->tokens[++i], sizeof(uint32_t));
-			printf("token-suffixed integer %d\n", arg_uint);
+			printf("token-suffixed integer %d\n", TL_ARG_UINT(p, i));
+			i++;
 			break;
 		default:
 			printf("token %d (%s)\n", p->tokens[i],
@@ -98,14 +130,38 @@ static void dump_parsed(void *user, t_tokenline_parsed *p)
 
 }
 
+#if TL_CONFIG_HISTORY
+/* Keep the history in a file across runs. */
+static void history_file(t_tokenline *tl, const char *path, int save)
+{
+	FILE *f;
+	void *image;
+	size_t size;
+
+	size = tl_history_image_size(tl);
+	if (!(image = malloc(size)))
+		return;
+	if (save) {
+		if ((f = fopen(path, "wb"))) {
+			fwrite(image, 1, tl_history_export(tl, image, size), f);
+			fclose(f);
+		}
+	} else if ((f = fopen(path, "rb"))) {
+		if (fread(image, 1, size, f) != size
+				|| !tl_history_import(tl, image, size))
+			fprintf(stderr, "%s: not a valid history file\n", path);
+		fclose(f);
+	}
+	free(image);
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	t_tokenline tl;
 	struct termios old_termios, new_termios;
-	int c;
-
-	(void)argc;
-	(void)argv;
+	uint8_t buf[64];
+	ssize_t len;
 
 	tcgetattr(0, &old_termios);
 	tcgetattr(0, &new_termios);
@@ -115,15 +171,36 @@ int main(int argc, char **argv)
 	tcsetattr(0, TCSAFLUSH, &new_termios);
 	ctx.tl = &tl;
 	tl_init(&tl, tokens, dict, print, &ctx);
+	tl.arg_views = TRUE;
+	/* Generated along with the tables, see commands.tl. */
+	tl_set_index(&tl, &token_index);
 	tl_set_prompt(&tl, "> ");
 	tl_set_callback(&tl, dump_parsed);
-	while (TRUE) {
-		c = getchar();
-		if (!tl_input(&tl, c))
+#ifdef TL_PROFILE
+	tl_set_cyclefunc(&tl, cycles);
+#endif
+#if TL_CONFIG_HISTORY
+	if (argc > 1)
+		history_file(&tl, argv[1], FALSE);
+#else
+	(void)argc;
+	(void)argv;
+#endif
+	/* Have the terminal mark pasted text. */
+	printf("\x1b[?2004h");
+	fflush(stdout);
+	while ((len = read(0, buf, sizeof(buf))) > 0) {
+		if (!tl_input_buf(&tl, buf, len, NULL))
 			break;
+		fflush(stdout);
 	}
+	printf("\x1b[?2004l");
 	tcsetattr(0, TCSANOW, &old_termios);
 	printf("\n");
+#if TL_CONFIG_HISTORY
+	if (argc > 1)
+		history_file(&tl, argv[1], TRUE);
+#endif
 
 	return 0;
 }
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2014 Bert Vermeulen <bert@biot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Exports history images and imports them into instances with other
+ * buffer sizes. Exits with 1 on the first mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokenline.h"
+
+enum {
+	T_SET = 1,
+	T_VALUE,
+};
+
+static t_token_dict dict[] = {
+	{ 0, "" },
+	{ T_SET, "set" },
+	{ T_VALUE, "value" },
+	{ }
+};
+
+static t_token tokens_set[] = {
+	{ T_VALUE, T_ARG_STRING, 0, NULL, "Value" },
+	{ }
+};
+
+static t_token tokens[] = {
+	{ T_SET, 0, 0, tokens_set, "Set" },
+	{ }
+};
+
+TL_DEFINE_BUFFERS(big, 128, 8, 512, 64);
+TL_DEFINE_BUFFERS(small, 32, 8, 512, 64);
+
+static uint8_t image[1024];
+
+static void print(void *user, const char *str)
+{
+	(void)user;
+	(void)str;
+}
+
+static void callback(void *user, t_tokenline_parsed *p)
+{
+	(void)user;
+	(void)p;
+}
+
+static void init(t_tokenline *tl, const t_tokenline_buffers *buffers)
+{
+	tl_init_buffers(tl, tokens, dict, print, NULL, buffers);
+	tl_set_callback(tl, callback);
+	tl_set_prompt(tl, "> ");
+}
+
+static void input(t_tokenline *tl, const char *line)
+{
+	while (*line)
+		tl_input(tl, *line++);
+	tl_input(tl, '\r');
+}
+
+static void check(const char *what, int ret, int expect)
+{
+	if (ret != expect) {
+		printf("%s: got %d, expected %d\n", what, ret, expect);
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	static t_tokenline src, dst;
+	size_t size;
+
+	init(&src, &big);
+	input(&src, "set short");
+	init(&dst, &small);
+	size = tl_history_export(&src, image, sizeof(image));
+	check("export", size > 0 && size <= sizeof(image), 1);
+	check("import short", tl_history_import(&dst, image, size), TRUE);
+
+	/* Recalling this into a 32-byte line would overflow it. */
+	input(&src, "set a-value-that-does-not-fit-in-32-bytes");
+	size = tl_history_export(&src, image, sizeof(image));
+	check("import long", tl_history_import(&dst, image, size), FALSE);
+	/* The rejected image left the history as it was. */
+	check("history kept", dst.hist_count, 1);
+
+	printf("history: ok\n");
+
+	return 0;
+}
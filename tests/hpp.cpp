@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2014 Bert Vermeulen <bert@biot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Builds a command tree with tokenline.hpp, runs lines through it and
+ * checks what the handlers got. Exits with 1 on the first mismatch.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "tokenline.hpp"
+
+static std::string got;
+
+static constexpr auto tree = tl::commands(
+	tl::cmd("num", "Number").arg<uint32_t>()
+		.handle([](uint32_t n) { got = "num " + std::to_string(n); }),
+	tl::cmd("name", "Name").arg<std::string_view>()
+		.handle([](std::string_view s) { got = "name " + std::string(s); }),
+	tl::cmd("set", "Set").sub(
+		tl::cmd("offset", "Offset").arg<int32_t>()
+			.handle([](int32_t n) { got = "offset " + std::to_string(n); }),
+		tl::cmd("address", "Address").arg<uint64_t>()
+			.handle([](uint64_t n) { got = "address " + std::to_string(n); }),
+		tl::cmd("voltage", "Voltage").arg<tl::fixed>()
+			.handle([](tl::fixed f) { got = "voltage " + std::to_string(f.raw); })),
+	tl::cmd("user", "User")
+		.handle([](void *user) { got = (const char *)user; }),
+	tl::cmd("help", "Available commands"));
+
+static void print(void *user, const char *str)
+{
+	(void)user;
+	(void)str;
+}
+
+static void check(tl::cli<tree> &cli, const char *line, int status,
+		const char *expect)
+{
+	int ret;
+
+	got.clear();
+	ret = cli.exec(line);
+	if (ret != status || got != expect) {
+		printf("%s: status %d, got \"%s\"; expected %d, \"%s\"\n", line,
+				ret, got.c_str(), status, expect);
+		exit(1);
+	}
+}
+
+int main()
+{
+	static tl::cli<tree> cli;
+	static char user[] = "user";
+
+	cli.init(print, user);
+	check(cli, "num 7", TL_OK, "num 7");
+	check(cli, "nu 0x10", TL_OK, "num 16");
+	check(cli, "name \"foo bar\"", TL_OK, "name foo bar");
+	check(cli, "set offset -3", TL_OK, "offset -3");
+	check(cli, "set address 4g", TL_OK, "address 4000000000");
+	check(cli, "set voltage 1.5", TL_OK, "voltage 98304");
+	check(cli, "user", TL_OK, "user");
+	/* A second command in the same parse would read the first's args. */
+	check(cli, "num 7 name bar", TL_ERR_TOO_MANY_ARGUMENTS, "");
+	check(cli, "num 7; name bar", TL_OK, "name bar");
+	check(cli, "name", TL_ERR_MISSING_ARGUMENT, "");
+	printf("tokenline.hpp: ok\n");
+
+	return 0;
+}
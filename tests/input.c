@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2014 Bert Vermeulen <bert@biot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Feeds a block through tl_input_buf() while the help listing in it
+ * waits for room in the transmit ring, and checks that the commands
+ * after it still run. Exits with 1 on the first mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokenline.h"
+
+enum {
+	T_SET = 1,
+	T_SHOW,
+	T_RESET,
+	T_LOAD,
+	T_SAVE,
+	T_HELP,
+};
+
+static t_token_dict dict[] = {
+	{ 0, "" },
+	{ T_SET, "set" },
+	{ T_SHOW, "show" },
+	{ T_RESET, "reset" },
+	{ T_LOAD, "load" },
+	{ T_SAVE, "save" },
+	{ T_HELP, "help" },
+	{ }
+};
+
+static t_token tokens[] = {
+	{ T_SET, T_ARG_UINT, 0, NULL, "Set the value to this number" },
+	{ T_SHOW, 0, 0, NULL, "Show the value as it is right now" },
+	{ T_RESET, 0, 0, NULL, "Reset the value to its default" },
+	{ T_LOAD, 0, 0, NULL, "Load the value from the flash page" },
+	{ T_SAVE, 0, 0, NULL, "Save the value to the flash page" },
+	{ T_HELP, 0, 0, NULL, "Available commands" },
+	{ }
+};
+
+static const char input[] = "help\rset 1\rset 2\r";
+
+static t_tokenline tl;
+static char got[64];
+
+static void print(void *user, const char *str)
+{
+	(void)user;
+	(void)str;
+}
+
+static void callback(void *user, t_tokenline_parsed *p)
+{
+	(void)user;
+	if (p->tokens[0] == T_SET)
+		sprintf(got + strlen(got), "set %u;",
+				*(uint32_t *)(p->buf + p->tokens[2]));
+}
+
+/* Send everything in the transmit ring. */
+static void drain(void)
+{
+	size_t len;
+
+	while (tl_tx_peek(&tl, &len))
+		tl_tx_consume(&tl, len);
+}
+
+int main(void)
+{
+	size_t pos, used;
+	int ret, calls;
+
+	tl_init(&tl, tokens, dict, print, NULL);
+	tl_set_callback(&tl, callback);
+	tl_set_tx_ring(&tl, TRUE);
+	tl_set_prompt(&tl, "> ");
+	drain();
+
+	ret = tl_input_buf(&tl, (const uint8_t *)input, sizeof(input) - 1, &used);
+	if (ret != TL_BUSY || used != strlen("help\r")) {
+		printf("listing: status %d, used %zu\n", ret, used);
+		exit(1);
+	}
+	/* Held back input goes in once the ring has room again. */
+	pos = used;
+	for (calls = 0; pos < sizeof(input) - 1 && calls < 100; calls++) {
+		drain();
+		tl_input_buf(&tl, (const uint8_t *)input + pos,
+				sizeof(input) - 1 - pos, &used);
+		pos += used;
+	}
+	drain();
+	if (pos != sizeof(input) - 1 || strcmp(got, "set 1;set 2;")) {
+		printf("rest: used %zu, got \"%s\"\n", pos, got);
+		exit(1);
+	}
+
+	printf("input: ok\n");
+
+	return 0;
+}
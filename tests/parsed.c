@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2014 Bert Vermeulen <bert@biot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tokenizes into, and captures into, parsed commands with little room.
+ * Exits with 1 on the first mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokenline.h"
+
+enum {
+	T_SET = 1,
+	T_NUM,
+	T_NAME,
+};
+
+static t_token_dict dict[] = {
+	{ 0, "" },
+	{ T_SET, "set" },
+	{ T_NUM, "num" },
+	{ T_NAME, "name" },
+	{ }
+};
+
+static t_token tokens_set[] = {
+	{ T_NUM, T_ARG_UINT, 0, NULL, "Number" },
+	{ T_NAME, T_ARG_STRING, 0, NULL, "Name" },
+	{ }
+};
+
+static t_token tokens[] = {
+	{ T_SET, 0, 0, tokens_set, "Set" },
+	{ }
+};
+
+TL_DEFINE_BUFFERS(small, 16, 6, 0, 0);
+TL_DEFINE_PARSED(saved, 6, 6);
+
+static t_tokenline tl;
+static int captured;
+static char got[64];
+
+static void print(void *user, const char *str)
+{
+	(void)user;
+	(void)str;
+}
+
+static void callback(void *user, t_tokenline_parsed *p)
+{
+	(void)user;
+	if (p->tokens[2] == T_ARG_UINT)
+		sprintf(got, "num %u", *(uint32_t *)(p->buf + p->tokens[3]));
+	else
+		sprintf(got, "name %s", p->buf + p->tokens[3]);
+	if (p != &saved)
+		captured = tl_capture(&tl, &saved);
+}
+
+static void check(const char *line, int status, const char *expect,
+		int capture)
+{
+	int ret;
+
+	got[0] = 0;
+	captured = -1;
+	ret = tl_exec_line(&tl, line, strlen(line));
+	if (ret != status || strcmp(got, expect) || captured != capture) {
+		printf("%s: status %d, got \"%s\", captured %d; expected %d, "
+				"\"%s\", %d\n", line, ret, got, captured, status,
+				expect, capture);
+		exit(1);
+	}
+}
+
+int main(void)
+{
+	tl_init_buffers(&tl, tokens, dict, print, NULL, &small);
+	tl_set_callback(&tl, callback);
+	tl_set_prompt(&tl, "> ");
+
+	check("set num 7", TL_OK, "num 7", TRUE);
+	tl_replay(&tl, &saved);
+	if (strcmp(got, "num 7")) {
+		printf("replay: got \"%s\"\n", got);
+		exit(1);
+	}
+	check("set name abc", TL_OK, "name abc", TRUE);
+	/* Fits the instance, but not the 6 bytes of saved. */
+	check("set name abcdef", TL_OK, "name abcdef", FALSE);
+	/* Needs more than the 6 tokens the instance has. */
+	check("set num 1 num 2", TL_ERR_TOO_MANY_WORDS, "", -1);
+
+	printf("parsed: ok\n");
+
+	return 0;
+}
@@ -22,1067 +22,3222 @@
 #include "tokenline.h"
 
 #define INDENT   "   "
+/* Minimum width of the keyword column in listings, help follows it. */
+#define HELP_COLUMN 15
 #define NO_HELP  "No help available."NL
 #define NL       "\r\n"
-#define HYDRABUS_SPECIAL_CHARS	 "[]{}/\\_-!^.&%~" 
 
-static void line_clear(t_tokenline *tl);
-static void line_backspace(t_tokenline *tl);
-static void set_line(t_tokenline *tl, char *line);
-static void add_char(t_tokenline *tl, int c);
-static void add_char_silent(t_tokenline *tl, int c);
-static char space[] = "               ";
+#if TL_CONFIG_SPECIAL_CHARS
+/* Character classes used by split_line_from(). */
+enum {
+	CC_SPECIAL = (1 << 0),
+	CC_QUOTE = (1 << 1),
+};
+
+/* The HydraBus special characters: "[]{}/\\_-!^.&%~" */
+static const uint8_t char_class[256] = {
+	['['] = CC_SPECIAL, [']'] = CC_SPECIAL, ['{'] = CC_SPECIAL,
+	['}'] = CC_SPECIAL, ['/'] = CC_SPECIAL, ['\\'] = CC_SPECIAL,
+	['_'] = CC_SPECIAL, ['-'] = CC_SPECIAL, ['!'] = CC_SPECIAL,
+	['^'] = CC_SPECIAL, ['.'] = CC_SPECIAL, ['&'] = CC_SPECIAL,
+	['%'] = CC_SPECIAL, ['~'] = CC_SPECIAL,
+	['"'] = CC_QUOTE,
+};
+#define CHAR_CLASS(c) char_class[(uint8_t)(c)]
+#endif
+
+#if TL_RX_RING_SIZE & (TL_RX_RING_SIZE - 1)
+#error "TL_RX_RING_SIZE must be a power of two."
+#endif
+#if TL_TX_RING_SIZE & (TL_TX_RING_SIZE - 1)
+#error "TL_TX_RING_SIZE must be a power of two."
+#endif
+#if TL_FIXED_FRAC_BITS < 0 || TL_FIXED_FRAC_BITS > 31
+#error "TL_FIXED_FRAC_BITS must be 0 to 31."
+#endif
+/* Token listings are shared by help and Tab. */
+#define TL_LISTINGS (TL_CONFIG_HELP || TL_CONFIG_COMPLETION)
+/* Whether any built-in command can be suspended, see job_room(). */
+#define TL_JOBS (TL_LISTINGS || TL_CONFIG_HISTORY || TL_MAX_ALIASES)
+/*
+ * Orders accesses to the receive and transmit rings' buffers and counters.
+ * A compiler barrier is enough when the other side runs in an interrupt on
+ * the same core; define it as a memory barrier instruction otherwise.
+ */
+#ifndef TL_RING_BARRIER
+#define TL_RING_BARRIER() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/* Built-in commands that can be suspended, see job_room(). */
+enum {
+	JOB_NONE,
+	JOB_HISTORY,
+	JOB_HELP,
+	/* Tab on an empty line or after a word. */
+	JOB_LIST,
+	JOB_ALIAS,
+};
+
+#ifdef TL_PROFILE
+/* Run stmt, adding the cycles it took to a phase's counters. */
+#define PROFILE(tl, phase, stmt) do { \
+		uint32_t prof_start = profile_start(tl); \
+		stmt; \
+		profile_end(tl, phase, prof_start); \
+	} while (0)
+#else
+#define PROFILE(tl, phase, stmt) stmt
+#endif
+
+#define CSI        "\x1b\x5b"
+#define ERASE_EOL  CSI "K"
+
+/* Escape sequence decoder states. */
+enum {
+	ESC_NONE,
+	ESC_ESC,
+	ESC_CSI,
+	/* A CSI sequence with private or intermediate bytes: no key of ours. */
+	ESC_CSI_IGNORE,
+	ESC_SS3,
+};
+
+/* Keys decoded from escape sequences. */
+enum {
+	KEY_NONE,
+	KEY_UP,
+	KEY_DOWN,
+	KEY_RIGHT,
+	KEY_LEFT,
+	KEY_WORD_RIGHT,
+	KEY_WORD_LEFT,
+	KEY_HOME,
+	KEY_END,
+	KEY_DELETE,
+	KEY_PASTE_START,
+	KEY_PASTE_END,
+	/* escape_input() is still collecting the sequence. */
+	KEY_MORE,
+	/* The byte isn't part of a sequence: handle it as normal input. */
+	KEY_ABORT,
+};
 
-static void unsplit_line(t_tokenline *tl)
+/*
+ * Escape sequences, by introducer ('[' for CSI, 'O' for SS3, 0 for ESC
+ * followed by a character), final byte, first parameter and xterm
+ * modifier parameter. Missing parameters are 1.
+ */
+static const struct escape_key {
+	char intro;
+	char final;
+	uint8_t mod;
+	uint8_t key;
+	uint16_t param;
+} escape_keys[] = {
+	{ '[', 'A', 1, KEY_UP, 1 },
+	{ '[', 'B', 1, KEY_DOWN, 1 },
+	{ '[', 'C', 1, KEY_RIGHT, 1 },
+	{ '[', 'D', 1, KEY_LEFT, 1 },
+	{ '[', 'H', 1, KEY_HOME, 1 },
+	{ '[', 'F', 1, KEY_END, 1 },
+	/* Ctrl and Alt arrows */
+	{ '[', 'C', 5, KEY_WORD_RIGHT, 1 },
+	{ '[', 'D', 5, KEY_WORD_LEFT, 1 },
+	{ '[', 'C', 3, KEY_WORD_RIGHT, 1 },
+	{ '[', 'D', 3, KEY_WORD_LEFT, 1 },
+	{ '[', '~', 1, KEY_HOME, 1 },
+	{ '[', '~', 1, KEY_DELETE, 3 },
+	{ '[', '~', 1, KEY_END, 4 },
+	{ '[', '~', 1, KEY_HOME, 7 },
+	{ '[', '~', 1, KEY_END, 8 },
+	/* Bracketed paste markers */
+	{ '[', '~', 1, KEY_PASTE_START, 200 },
+	{ '[', '~', 1, KEY_PASTE_END, 201 },
+	{ 'O', 'A', 1, KEY_UP, 1 },
+	{ 'O', 'B', 1, KEY_DOWN, 1 },
+	{ 'O', 'C', 1, KEY_RIGHT, 1 },
+	{ 'O', 'D', 1, KEY_LEFT, 1 },
+	{ 'O', 'H', 1, KEY_HOME, 1 },
+	{ 'O', 'F', 1, KEY_END, 1 },
+	/* Alt-b and Alt-f */
+	{ 0, 'b', 1, KEY_WORD_LEFT, 1 },
+	{ 0, 'f', 1, KEY_WORD_RIGHT, 1 },
+};
+
+#ifdef TL_PROFILE
+static uint32_t profile_start(t_tokenline *tl)
 {
-	int quoted, i;
+	return tl->cycles ? tl->cycles() : 0;
+}
 
-	quoted = FALSE;
-	for (i = 0; i < tl->buf_len; i++) {
-		if (tl->buf[i] == '"') {
-			quoted = TRUE;
-			continue;
+static void profile_end(t_tokenline *tl, int phase, uint32_t start)
+{
+	t_phase_stats *ps;
+	uint32_t cycles;
+
+	cycles = tl->cycles ? tl->cycles() - start : 0;
+	ps = &tl->stats.phases[phase];
+	ps->count++;
+	ps->total += cycles;
+	if (cycles > ps->max)
+		ps->max = cycles;
+}
+#endif
+
+#if TL_TX_RING_SIZE
+static uint32_t tx_room(t_tokenline *tl)
+{
+	return TL_TX_RING_SIZE - (tl->tx.head - tl->tx.tail);
+}
+
+/* Copy as much of buf to the transmit ring as fits, returning how much. */
+static int tx_write(t_tokenline *tl, const char *buf, int len)
+{
+	uint32_t head, pos, room;
+	int n;
+
+	head = tl->tx.head;
+	room = tx_room(tl);
+	if ((uint32_t)len > room)
+		len = room;
+	pos = head & (TL_TX_RING_SIZE - 1);
+	n = TL_TX_RING_SIZE - pos;
+	if (n > len)
+		n = len;
+	memcpy(tl->tx.buf + pos, buf, n);
+	memcpy(tl->tx.buf, buf + n, len - n);
+	TL_RING_BARRIER();
+	tl->tx.head = head + len;
+
+	return len;
+}
+#endif
+
+/*
+ * All output is collected in out_buf, and handed to the print or write
+ * function when it fills up, or at the end of every input event. With the
+ * transmit ring on, it's moved there instead, and whatever doesn't fit
+ * stays in out_buf.
+ */
+void tl_flush(t_tokenline *tl)
+{
+#if TL_TX_RING_SIZE
+	int n;
+#endif
+
+	if (!tl->out_len)
+		return;
+#if TL_TX_RING_SIZE
+	if (tl->tx_ring) {
+		n = tx_write(tl, tl->out_buf, tl->out_len);
+		memmove(tl->out_buf, tl->out_buf + n, tl->out_len - n);
+		tl->out_len -= n;
+		return;
+	}
+#endif
+	if (tl->write) {
+		PROFILE(tl, TL_PHASE_PRINT,
+				tl->write(tl->user, tl->out_buf, tl->out_len));
+	} else {
+		tl->out_buf[tl->out_len] = 0;
+		PROFILE(tl, TL_PHASE_PRINT, tl->print(tl->user, tl->out_buf));
+	}
+	tl->out_len = 0;
+}
+
+static void output_len(t_tokenline *tl, const char *str, int len)
+{
+	int size;
+
+#ifdef TL_PROFILE
+	tl->cur_line_bytes += len;
+#endif
+	while (len) {
+		size = TL_MAX_OUTPUT_LEN - tl->out_len;
+		if (size > len)
+			size = len;
+		memcpy(tl->out_buf + tl->out_len, str, size);
+		tl->out_len += size;
+		str += size;
+		len -= size;
+		if (tl->out_len == TL_MAX_OUTPUT_LEN)
+			tl_flush(tl);
+#if TL_TX_RING_SIZE
+		if (tl->out_len == TL_MAX_OUTPUT_LEN) {
+			/* Transmit ring full. */
+			tl->tx.dropped += len;
+			return;
 		}
-		if (!tl->buf[i]) {
-			if (quoted) {
-				tl->buf[i] = '"';
-				quoted = FALSE;
-			} else {
-				tl->buf[i] = ' ';
-			}
+#endif
+	}
+}
+
+static void output(t_tokenline *tl, const char *str)
+{
+	output_len(tl, str, strlen(str));
+}
+
+#if TL_JOBS
+/*
+ * Is there room for a built-in command to output len more characters, one
+ * item's worth, right now? If not, it's suspended and picked up again by
+ * job_resume(). That only happens with the transmit ring on, and while
+ * running a line from buf: anything else gets all of its output, even if
+ * some of that is dropped.
+ */
+static int job_room(t_tokenline *tl, int len)
+{
+#if TL_TX_RING_SIZE
+	if (!tl->tx_ring || !tl->job_resumable)
+		return TRUE;
+	tl_flush(tl);
+	if (len > TL_TX_RING_SIZE)
+		len = TL_TX_RING_SIZE;
+
+	return !tl->out_len && tx_room(tl) >= (uint32_t)len;
+#else
+	(void)tl;
+	(void)len;
+
+	return TRUE;
+#endif
+}
+#endif
+
+static int job_run(t_tokenline *tl);
+
+/* The line was changed from position pos on. */
+static void line_changed(t_tokenline *tl, int pos)
+{
+#if TL_CONFIG_COMPLETION
+	if (pos < tl->tok_cache_len)
+		tl->tok_cache_len = 0;
+#else
+	(void)tl;
+	(void)pos;
+#endif
+}
+
+/* Formats n in decimal, returns the number of characters written. */
+static int format_uint(char *s, uint32_t n)
+{
+	char tmp[10];
+	int len, i;
+
+	len = 0;
+	do {
+		tmp[len++] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	for (i = 0; i < len; i++)
+		s[i] = tmp[len - 1 - i];
+
+	return len;
+}
+
+/* Move the cursor n columns right, or left if negative. */
+static void cursor_move(t_tokenline *tl, int n)
+{
+	char seq[16];
+	int len;
+
+	if (!n)
+		return;
+	memcpy(seq, CSI, 2);
+	len = 2;
+	if (n < -1 || n > 1)
+		len += format_uint(seq + len, n < 0 ? -n : n);
+	seq[len++] = n < 0 ? 'D' : 'C';
+	output_len(tl, seq, len);
+}
+
+#if TL_CONFIG_HISTORY
+static void line_replace(t_tokenline *tl, const char *line);
+#endif
+static void add_char(t_tokenline *tl, int c);
+#if TL_LISTINGS || TL_MAX_ALIASES
+static char space[] = "               ";
+#endif
+
+#if TL_CONFIG_SPECIAL_CHARS
+/*
+ * Does any keyword longer than one character start with the len bytes
+ * at word? Only called when the last of those is a special character,
+ * so only keywords containing one need to be considered.
+ */
+static int special_prefix(t_tokenline *tl, char *word, int len)
+{
+	const t_token_index *index;
+	int lo, hi, mid, x;
+
+	index = tl->index;
+	if (!index || index->num_special == -1) {
+		for (x = 1; tl->token_dict[x].token; x++) {
+			if (!strncmp(word, tl->token_dict[x].tokenstr, len)
+					&& strlen(tl->token_dict[x].tokenstr) > 1)
+				return TRUE;
 		}
+		return FALSE;
 	}
-	tl->buf[tl->buf_len] = 0;
+
+	lo = 0;
+	hi = index->num_special;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strncmp(index->token_dict[index->special[mid]].tokenstr, word, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < index->num_special
+		&& !strncmp(index->token_dict[index->special[lo]].tokenstr, word, len);
+}
+#endif
+
+static const char *error_msgs[] = {
+	[TL_ERR_TOO_MANY_WORDS] = "Too many words.",
+	[TL_ERR_UNMATCHED_QUOTE] = "Unmatched quote.",
+	[TL_ERR_TOO_MANY_ARGUMENTS] = "Too many arguments.",
+	[TL_ERR_INVALID_NUMBER] = "Invalid number.",
+	[TL_ERR_SUFFIX_NOT_ALLOWED] = "Token suffix not allowed.",
+	[TL_ERR_INVALID_COMMAND] = "Invalid command.",
+	[TL_ERR_INVALID_VALUE] = "Invalid value.",
+	[TL_ERR_MISSING_ARGUMENT] = "Missing argument.",
+	[TL_ERR_INVALID_COUNT] = "Invalid count.",
+	[TL_ERR_NO_PREVIOUS_COMMAND] = "No previous command.",
+	[TL_ERR_LINE_TOO_LONG] = "Line too long.",
+	[TL_ERR_TOO_MANY_ALIASES] = "Too many aliases.",
+	[TL_ERR_NO_SUCH_ALIAS] = "No such alias.",
+};
+
+/*
+ * Record the status of the line being processed, and print its message
+ * unless silent or in batch mode. Returns FALSE, for use as an error
+ * return value.
+ */
+static int error(t_tokenline *tl, int status, int silent)
+{
+	tl->status = status;
+	if (!silent && !tl->batch) {
+		output(tl, error_msgs[status]);
+		output(tl, NL);
+	}
+
+	return FALSE;
+}
+
+#if TL_CONFIG_SPECIAL_CHARS
+/*
+ * Whether c, following the len characters of word and followed by next,
+ * is the decimal point of a number such as 1.5, not a word of its own.
+ */
+static int decimal_point(const char *word, int len, char next, char c)
+{
+	int i;
+
+	if (c != '.' || next < '0' || next > '9')
+		return FALSE;
+	for (i = 0; i < len; i++) {
+		if (word[i] < '0' || word[i] > '9')
+			return FALSE;
+	}
+
+	return TRUE;
 }
+#endif
 
-static int split_line(t_tokenline *tl, int *words, int *num_words, int silent)
+/*
+ * Split len bytes of line into NULL-terminated words in split_buf,
+ * leaving the line itself untouched. The HydraBus special characters
+ * become words of their own, unless they're part of a keyword or the
+ * decimal point of a number. Every byte of the line is visited once;
+ * since at most one terminator is added per word, split_buf always has
+ * room.
+ *
+ * Splitting can be resumed at the start of any word, given its position
+ * in the line and in split_buf, and the number of words before it.
+ */
+static int split_line_from(t_tokenline *tl, const char *line, int len,
+		int pos, int out, int num_words, int silent)
 {
-	int state, quoted, tokened, i, x;
+	int state, quoted, i;
+	char *split, c;
+#if TL_CONFIG_SPECIAL_CHARS
+	int start;
+	char next;
+
+	start = out;
+#endif
+	split = tl->split_buf;
 	state = 1;
 	quoted = FALSE;
-	tokened = FALSE;
-	*num_words = 0;
-	for (i = 0; i < tl->buf_len && *num_words < TL_MAX_WORDS; i++) {
+	tl->num_words = num_words;
+	for (i = pos; i < len; i++) {
+		c = line[i];
+#if TL_CONFIG_SPECIAL_CHARS
+		if (state == 2 && !quoted && CHAR_CLASS(c) & (CC_SPECIAL | CC_QUOTE)
+				&& split[out - 1] != ':' && !decimal_point(split + start,
+				out - start, i + 1 < len ? line[i + 1] : 0, c)) {
+			/* Special character not part of a keyword starts a new word. */
+			split[out] = c;
+			if (!special_prefix(tl, split + start, out - start + 1)) {
+				split[out++] = 0;
+				state = 1;
+			}
+		}
+#else
+		if (state == 2 && !quoted && c == '"' && split[out - 1] != ':') {
+			/* A quote starts a new word. */
+			split[out++] = 0;
+			state = 1;
+		}
+#endif
+
 		switch (state) {
 		case 1:
 			/* Looking for a new word. */
-			if (tl->buf[i] == ' ')
+			if (c == ' ')
 				continue;
-			if (tl->buf[i] == '"')
-				quoted = TRUE;
-
-			if (!quoted && strchr(HYDRABUS_SPECIAL_CHARS, tl->buf[i])) {
-				if(tl->buf[i+1] != ' ' && tl->buf[i+1] != 0 && tl->buf[i+1] != ':' && i < tl->buf_len) {
-					if((tl->buf_len + 1 < TL_MAX_LINE_LEN) && (*num_words + 1 < TL_MAX_WORDS)) {
-						tl->pos=i+1;
-						add_char_silent(tl, ' ');
-					} else {
-						if (!silent)
-							tl->print(tl->user, "Uncompressed form too big"NL);
-						unsplit_line(tl);
-						return FALSE;
-					}
-				}
+			if (tl->num_words == tl->max_words - 1) {
+				return error(tl, TL_ERR_TOO_MANY_WORDS, silent);
 			}
-			words[(*num_words)++] = i ;
+			if (c == '"')
+				quoted = TRUE;
+#if TL_CONFIG_SPECIAL_CHARS
+			start = out;
+#endif
+			tl->word_pos = i;
+			tl->words[tl->num_words++] = out;
+			split[out++] = c;
+#if TL_CONFIG_SPECIAL_CHARS
+			next = i + 1 < len ? line[i + 1] : 0;
+			if (!quoted && CHAR_CLASS(c) & CC_SPECIAL
+					&& next != ' ' && next != 0 && next != ':')
+				split[out++] = 0;
+			else
+				state = 2;
+#else
 			state = 2;
+#endif
 			break;
 		case 2:
-			if(!quoted && tl->buf[i] != ' '){
-				tokened = FALSE;
-				for (x = 1; tl->token_dict[x].token; x++) {
-					if (!strncmp(tl->buf+words[(*num_words-1)], tl->token_dict[x].tokenstr,
-								i-words[(*num_words-1)]+1) && strlen(tl->token_dict[x].tokenstr) > 1) 
-					{
-						tokened = TRUE;
-					}
-				}
-				if (!tokened && (strchr(HYDRABUS_SPECIAL_CHARS, tl->buf[i]) || tl->buf[i] == '"')){
-					if (tl->buf[i-1] != ' ' && tl->buf[i-1] != 0 && tl->buf[i-1] != ':') {
-						if((tl->buf_len + 1 < TL_MAX_LINE_LEN) && (*num_words + 1 < TL_MAX_WORDS)){
-							tl->pos=i;
-							add_char_silent(tl, ' ');
-						} else {
-							if (!silent)
-								tl->print(tl->user, "Uncompressed form too big"NL);
-							unsplit_line(tl);
-							return FALSE;
-						}
-					}
-				} 
-			}
 			/* In a word. */
-			if (quoted && tl->buf[i] == '"') {
+			if (quoted && c == '"') {
 				quoted = FALSE;
-				tl->buf[i] = 0;
-				if (tl->buf[i+1] != ' ') { 
-					if((tl->buf_len + 1 < TL_MAX_LINE_LEN) && (*num_words + 1 < TL_MAX_WORDS)){
-						tl->pos=i+1;
-						add_char_silent(tl, ' ');
-					} else {
-						if (!silent)
-							tl->print(tl->user, "Uncompressed form too big"NL);
-						unsplit_line(tl);
-						return FALSE;
-                        		} 
-                		}
+				split[out++] = 0;
 				state = 1;
-			} else if (!quoted && tl->buf[i] == ' ') {
-				tl->buf[i] = 0;
+			} else if (!quoted && c == ' ') {
+				split[out++] = 0;
 				state = 1;
+			} else {
+				split[out++] = c;
 			}
 			break;
 		}
 	}
-	if (quoted) {
-		if (!silent)
-			tl->print(tl->user, "Unmatched quote."NL);
-		unsplit_line(tl);
-		return FALSE;
-	}
-	if (*num_words > TL_MAX_WORDS - 1) {
-		if (!silent)
-			tl->print(tl->user, "Too many words."NL);
-		unsplit_line(tl);
-		return FALSE;
-	}
-	
-	tl->pos=tl->buf_len;
+	if (quoted)
+		return error(tl, TL_ERR_UNMATCHED_QUOTE, silent);
+	if (state == 2)
+		split[out++] = 0;
+	tl->split_len = out;
 
 	return TRUE;
 }
 
-static int history_previous(t_tokenline *tl, int entry)
+/* Length of the first command in line, up to a separator not in quotes. */
+static int command_len(t_tokenline *tl, const char *line, int len)
 {
-	int prev;
+	int quoted, i;
 
-	if (entry == tl->hist_begin)
-		return -1;
+	quoted = FALSE;
+	for (i = 0; i < len; i++) {
+		if (line[i] == '"')
+			quoted = !quoted;
+		else if (line[i] == tl->separator && tl->separator && !quoted)
+			break;
+	}
 
-	/* Onto the terminating zero of the previous entry. */
-	if (--entry < 0)
-		entry = TL_MAX_HISTORY_SIZE - 1;
+	return i;
+}
 
-	/* Onto the last byte of the previous entry. */
-	prev = entry;
-	if (--entry < 0)
-		entry = TL_MAX_HISTORY_SIZE - 1;
-	while (tl->hist_buf[entry]) {
-		prev = entry;
-		if (--entry < 0)
-			entry = TL_MAX_HISTORY_SIZE - 1;
-	}
+#if TL_CONFIG_HISTORY || TL_CONFIG_COMPLETION
+/* Where the last command in line starts. */
+static int last_command(t_tokenline *tl, const char *line, int len)
+{
+	int start, n;
+
+	start = 0;
+	while ((n = command_len(tl, line + start, len - start)) < len - start)
+		start += n + 1;
+
+	return start;
+}
+#endif
 
-	return prev;
+#if TL_CONFIG_HISTORY
+/* History entry n, counting from the oldest one. */
+static t_history_entry *history_entry(t_tokenline *tl, int n)
+{
+	n += tl->hist_first;
+	if (n >= tl->hist_entries)
+		n -= tl->hist_entries;
+
+	return &tl->hist_index[n];
 }
 
 static void history_up(t_tokenline *tl)
 {
-	int entry;
+	t_history_entry *entry;
 
-	if (tl->hist_step == -1)
-		entry = history_previous(tl, tl->hist_end);
-	else
-		entry = history_previous(tl, tl->hist_step);
-	if (entry == -1)
+	if (tl->hist_step + 1 >= tl->hist_count)
 		return;
-	line_clear(tl);
-	if (tl->hist_begin != 0 && TL_MAX_HISTORY_SIZE == strlen(tl->hist_buf + entry) + entry) {
-		set_line(tl, tl->hist_buf + entry);
-		set_line(tl, tl->hist_buf);
-	} else {
-		set_line(tl, tl->hist_buf + entry);
-	}
-	tl->hist_step = entry;
+	tl->hist_step++;
+	entry = history_entry(tl, tl->hist_count - 1 - tl->hist_step);
+	line_replace(tl, tl->hist_buf + entry->offset);
 }
 
 static void history_down(t_tokenline *tl)
 {
-	int i;
+	t_history_entry *entry;
 
 	if (tl->hist_step == -1)
 		return;
-
-	line_clear(tl);
-	if (tl->hist_step == tl->hist_end) {
-		tl->hist_step = -1;
+	if (--tl->hist_step == -1) {
+		line_replace(tl, "");
 		return;
 	}
-
-	i = tl->hist_step;
-	while (tl->hist_buf[i]) {
-		if (++i == TL_MAX_HISTORY_SIZE)
-			i = 0;
-	}
-	if (++i == TL_MAX_HISTORY_SIZE)
-		i = 0;
-
-	set_line(tl, tl->hist_buf + i);
-	tl->hist_step = i;
+	entry = history_entry(tl, tl->hist_count - 1 - tl->hist_step);
+	line_replace(tl, tl->hist_buf + entry->offset);
 }
 
-static void history_show(t_tokenline *tl)
+/* Returns FALSE when it ran out of room, see job_room(). */
+static int history_run(t_tokenline *tl)
 {
-	int entry, i;
-
-	/* Skip the 'history' command itself. */
-	entry = history_previous(tl, tl->hist_end);
-	for (entry = history_previous(tl, entry); entry != -1;
-			entry = history_previous(tl, entry)) {
-		tl->print(tl->user, tl->hist_buf + entry);
-
-		/* Did we drop off the end of the buffer? */
-		for (i = entry; i < TL_MAX_HISTORY_SIZE; i++) {
-			if (!tl->hist_buf[i])
-				break;
-		}
-		if (i == TL_MAX_HISTORY_SIZE)
-			/* Yes we did */
-			tl->print(tl->user, tl->hist_buf);
+	t_history_entry *entry;
 
-		tl->print(tl->user, NL);
+	for (; tl->job.pos >= 0; tl->job.pos--) {
+		entry = history_entry(tl, tl->job.pos);
+		if (!job_room(tl, entry->len + 2))
+			return FALSE;
+		output_len(tl, tl->hist_buf + entry->offset, entry->len);
+		output(tl, NL);
 	}
 
+	return TRUE;
 }
 
-/* Free at least size, but also fully zero out any deleted entry. */
-static int history_delete(t_tokenline *tl, int entry, int size)
+/*
+ * The newest entry from before the line being run, or -1. The line was
+ * added to the history first, unless it's run in batch mode or with
+ * tl_exec_line(), or it didn't fit.
+ */
+static int history_before_line(t_tokenline *tl)
 {
-	int freed, i;
+	t_history_entry *entry;
+	int i;
 
-	freed = 0;
-	i = entry;
-	while (freed < size || tl->hist_buf[i]) {
-		tl->hist_buf[i] = 0;
-		freed++;
-		if (++i == TL_MAX_HISTORY_SIZE)
-			i = 0;
+	i = tl->hist_count - 1;
+	if (!tl->batch && i >= 0) {
+		entry = history_entry(tl, i);
+		if (entry->len == tl->buf_len
+				&& !memcmp(tl->hist_buf + entry->offset, tl->buf, tl->buf_len))
+			i--;
 	}
-	tl->hist_buf[i] = 0;
-	/*
-	 * Skip at least over the terminating zero, and any after that,
-	 * to the next entry.
-	 */
-	do {
-		if (++i == TL_MAX_HISTORY_SIZE)
-			i = 0;
-	} while (!tl->hist_buf[i] && i < entry);
 
 	return i;
 }
 
+static void history_show(t_tokenline *tl)
+{
+	/* Newest first, skipping the line with the 'history' command. */
+	tl->job.type = JOB_HISTORY;
+	tl->job.pos = history_before_line(tl);
+	job_run(tl);
+}
+
+/*
+ * Entries are kept whole and NULL-terminated in hist_buf, in the order
+ * they were added, starting over at the beginning of the buffer when the
+ * next one doesn't fit at the end. The oldest entries are dropped when
+ * their space is needed.
+ */
 static void history_add(t_tokenline *tl)
 {
-	int size, entry, part1;
+	t_history_entry *entry;
+	int size, offset, end, wrapped;
 
-	size = strlen(tl->buf) + 1;
-	if (tl->hist_begin == tl->hist_end) {
-		/* First entry, both are 0. */
-		memcpy(tl->hist_buf, tl->buf, size);
-	} else if (tl->hist_begin < tl->hist_end) {
-		if (TL_MAX_HISTORY_SIZE - tl->hist_end >= size) {
-			memcpy(tl->hist_buf + tl->hist_end, tl->buf, size);
-		} else {
-			part1 = TL_MAX_HISTORY_SIZE - tl->hist_end;
-			entry = tl->hist_begin;
-			tl->hist_begin = history_delete(tl, entry, size - part1);
-			memcpy(tl->hist_buf + tl->hist_end, tl->buf, part1);
-			memcpy(tl->hist_buf, tl->buf + part1, size - part1);
-		}
-	} else {
-		part1 = tl->hist_begin - tl->hist_end;
-		if (part1 <= size) {
-			/* Not enough room between end and begin. */
-			tl->hist_begin = history_delete(tl, tl->hist_begin, size - part1);
-			part1 = TL_MAX_HISTORY_SIZE - tl->hist_end;
-			if (part1 < size) {
-				memcpy(tl->hist_buf + tl->hist_end, tl->buf, part1);
-				memcpy(tl->hist_buf, tl->buf + part1, size - part1);
-			} else {
-				memcpy(tl->hist_buf + tl->hist_end, tl->buf, size);
-			}
-		} else {
-			/* Enough room between end and begin. */
-			memcpy(tl->hist_buf + tl->hist_end, tl->buf, size);
+	size = tl->buf_len + 1;
+	if (size > tl->hist_size)
+		return;
+
+	end = offset = 0;
+	wrapped = FALSE;
+	if (tl->hist_count) {
+		entry = history_entry(tl, tl->hist_count - 1);
+		end = offset = entry->offset + entry->len + 1;
+		if (offset + size > tl->hist_size) {
+			offset = 0;
+			wrapped = TRUE;
 		}
 	}
-	tl->hist_end += size;
-	if (tl->hist_end >= TL_MAX_HISTORY_SIZE)
-		tl->hist_end -= TL_MAX_HISTORY_SIZE;
-	if (tl->hist_begin == tl->hist_end)
-		tl->hist_begin = history_delete(tl, tl->hist_begin,
-				strlen(tl->hist_buf + tl->hist_begin));
+
+	while (tl->hist_count) {
+		entry = history_entry(tl, 0);
+		if (tl->hist_count < tl->hist_entries
+				&& !(wrapped && entry->offset >= end)
+				&& (entry->offset >= offset + size
+				|| entry->offset + entry->len + 1 <= offset))
+			break;
+		/* Drop the oldest entry. */
+		if (++tl->hist_first == tl->hist_entries)
+			tl->hist_first = 0;
+		tl->hist_count--;
+	}
+
+	memcpy(tl->hist_buf + offset, tl->buf, size);
+	entry = history_entry(tl, tl->hist_count++);
+	entry->offset = offset;
+	entry->len = size - 1;
 }
 
 /*
- * Converts string to uint32_t. Takes decimal, hex prefixed with 0x,
- * binary prefixed with 0b and octal prefixed with 0. Returns FALSE
- * if conversion in any of these fails.
- * endptr: Reference to an object of type char*, whose value is set by 
-           the function to the next character in str after the numerical value.
-           This parameter can also be a null pointer, in which case it is not used.
+ * Find the newest entry, starting at entry n and going back, which
+ * contains the search string.
  */
-static int str_to_uint(char *s, uint32_t *out, char **endptr)
+static int history_search(t_tokenline *tl, int n)
 {
+	t_history_entry *entry;
+	char *s;
 	int i;
-	char *suffix;
-	char character;
-
-	if (endptr != 0)
-		*endptr = NULL;
-
-	if (strncmp(s, "0b", 2)) {
-		*out = strtoul(s, &suffix, 0);
-		character = *suffix;
-		if (character == 'k' || 
-			character == 'm' ||
-			character == 'g' )
-		{
-			if (endptr != 0)
-				*endptr = suffix;
-
-			suffix++;
-		}
 
-		if (*suffix != '\0')
-			return FALSE;
-	} else {
-		*out = 0;
-		for (i = 2; s[i]; i++) {
-			if (s[i] != '0' && s[i] != '1')
-				return FALSE;
-			*out <<= 1;
-			*out |= s[i] - 0x30;
+	for (; n >= 0; n--) {
+		entry = history_entry(tl, n);
+		s = tl->hist_buf + entry->offset;
+		for (i = 0; i + tl->search_len <= entry->len; i++) {
+			if (s[i] == tl->search_buf[0]
+					&& !memcmp(s + i, tl->search_buf, tl->search_len))
+				return n;
 		}
 	}
 
-	return TRUE;
+	return -1;
 }
 
-static char *arg_type_to_string(int arg_type)
+static void search_redraw(t_tokenline *tl, int failed)
 {
-	if (arg_type == T_ARG_UINT)
-		return "<integer>";
-	else if (arg_type == T_ARG_FLOAT)
-		return "<float>";
-	else if (arg_type == T_ARG_STRING)
-		return "<string>";
+	t_history_entry *entry;
 
-	return NULL;
+	output(tl, "\r");
+	if (failed)
+		output(tl, "(failing reverse-i-search)`");
+	else
+		output(tl, "(reverse-i-search)`");
+	output_len(tl, tl->search_buf, tl->search_len);
+	output(tl, "': ");
+	if (tl->search_match != -1) {
+		entry = history_entry(tl, tl->search_match);
+		output_len(tl, tl->hist_buf + entry->offset, entry->len);
+	}
+	output(tl, ERASE_EOL);
 }
 
-static int find_token(t_token *tokens, t_token_dict *token_dict, char *word)
+static void search_start(t_tokenline *tl)
 {
-	uint32_t arg_uint;
-	int token, partial, i;
+	tl->searching = TRUE;
+	tl->search_len = 0;
+	tl->search_match = -1;
+	search_redraw(tl, FALSE);
+}
 
-	/* Find exact match. */
-	for (i = 0; tokens[i].token; i++) {
-		token = tokens[i].token;
-		if (token == T_ARG_UINT) {
-			if (str_to_uint(word, &arg_uint, NULL))
-				return i;
-		} else if (token > T_ARG_UINT) {
-			continue;
-		} else {
-			if (!strcmp(word, token_dict[token].tokenstr))
-				return i;
-		}
+/* Leave search mode, taking the match as the new line if accepted. */
+static void search_end(t_tokenline *tl, int accept)
+{
+	t_history_entry *entry;
+
+	tl->searching = FALSE;
+	if (accept && tl->search_match != -1) {
+		entry = history_entry(tl, tl->search_match);
+		memcpy(tl->buf, tl->hist_buf + entry->offset, entry->len + 1);
+		tl->buf_len = entry->len;
+		line_changed(tl, 0);
 	}
+	tl->pos = tl->buf_len;
+	tl->hist_step = -1;
+	output(tl, "\r");
+	output(tl, tl->prompt);
+	output(tl, tl->buf);
+	output(tl, ERASE_EOL);
+}
 
-	/* Find partial match. */
-	partial = -1;
-	for (i = 0; tokens[i].token; i++) {
-		token = tokens[i].token;
-		if (token >= T_ARG_UINT)
-			continue;
-		if (strlen(word) >= strlen(token_dict[token].tokenstr))
-			continue;
-		if (!strncmp(word, token_dict[token].tokenstr, strlen(word))) {
-			if (partial != -1)
-				/* Not unique. */
-				return -1;
-			else
-				partial = i;
-		}
+/*
+ * Handle a character while searching. Returns FALSE if it ended the
+ * search, and still needs to be handled as normal input.
+ */
+static int search_input(t_tokenline *tl, uint8_t c)
+{
+	int match, from;
+
+	if (c >= 0x20 && c <= 0x7e) {
+		if (tl->search_len == TL_MAX_SEARCH_LEN)
+			return TRUE;
+		tl->search_buf[tl->search_len++] = c;
+		/* Newer entries didn't match the shorter string either. */
+		from = tl->search_match == -1 ? tl->hist_count - 1 : tl->search_match;
+	} else if (c == 0x7f) {
+		/* Backspace */
+		if (!tl->search_len)
+			return TRUE;
+		tl->search_len--;
+		from = tl->hist_count - 1;
+	} else if (c == 0x12) {
+		/* Ctrl-r: next older match */
+		if (!tl->search_len || tl->search_match == -1)
+			return TRUE;
+		from = tl->search_match - 1;
+	} else if (c == 0x07) {
+		/* Ctrl-g: give up, back to the line as it was. */
+		search_end(tl, FALSE);
+		return TRUE;
+	} else {
+		search_end(tl, TRUE);
+		return FALSE;
 	}
 
-	return partial;
+	match = tl->search_len ? history_search(tl, from) : -1;
+	if (match != -1 || !tl->search_len)
+		tl->search_match = match;
+	search_redraw(tl, match == -1 && tl->search_len);
+
+	return TRUE;
 }
+#endif
 
 /*
- * Tokenize the current set of NULL-terminated words, allowing for
- * one token sublevel starting from the current token level.
+ * Parse an unsigned integer: decimal, hex prefixed with 0x, binary
+ * prefixed with 0b or octal prefixed with 0, optionally followed by k
+ * (kilo), m (mega) or g (giga). Done in a single pass, without libc.
+ * Returns FALSE if s isn't all number, or its value is over max.
  */
-static int tokenize(t_tokenline *tl, int *words, int num_words,
-		t_token **complete_tokens, int *complete_arg)
+static int parse_uint(const char *s, uint64_t max, uint64_t *out)
 {
-	t_token *token_stack[8], *arg_tokens;
-	t_tokenline_parsed *p;
-	float arg_float;
-	uint32_t arg_uint, suffix_uint;
-	int done, arg_needed, w, t, t_idx, size;
-	int cur_tsp, cur_tp, cur_bufsize, i;
-	char *word, *suffix;
-
-	done = FALSE;
-	p = &tl->parsed;
-	token_stack[0] = tl->token_levels[tl->token_level];
-	cur_tsp = 0;
-	cur_tp = 0;
-	cur_bufsize = 0;
-	arg_needed = 0;
-	arg_tokens = NULL;
-	for (w = 0; w < num_words; w++) {
-		word = tl->buf + words[w];
-		if (done) {
-			if (!complete_tokens)
-				tl->print(tl->user, "Too many arguments."NL);
-			return FALSE;
-		} else if (!arg_needed) {
-			/* Token needed. */
-			if ((suffix = strchr(word, TL_TOKEN_DELIMITER))) {
-				*suffix++ = 0;
-				if (!str_to_uint(suffix, &suffix_uint, NULL)) {
-					tl->print(tl->user, "Invalid number."NL);
-					return FALSE;
-				}
-			} else {
-				suffix_uint = 0;
-			}
+	uint64_t n, limit;
+	uint32_t base, d, limit_d, mult;
+	const char *digits;
+
+	base = 10;
+	if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+		base = 16;
+		s += 2;
+	} else if (s[0] == '0' && s[1] == 'b') {
+		base = 2;
+		s += 2;
+	} else if (s[0] == '0' && s[1] >= '0' && s[1] <= '9') {
+		base = 8;
+		s++;
+	}
 
-			if ((t_idx = find_token(token_stack[cur_tsp], tl->token_dict, word)) > -1 && word[0] != '"') {
-				t = token_stack[cur_tsp][t_idx].token;
-				if (!(cur_tp + 1 < TL_MAX_WORDS)){
-					tl->print(tl->user, "Too many words."NL);
-					return FALSE;
-				}
-				p->tokens[cur_tp++] = t;
-				if (t == T_ARG_UINT) {
-					/* Integer token. */
-					str_to_uint(word, &arg_uint, NULL);
-					if (!(cur_tp + 1 < TL_MAX_WORDS)){
-						tl->print(tl->user, "Too many words."NL);
-						return FALSE;
+	/* n * base + d must not go over max. */
+	limit = max / base;
+	limit_d = max % base;
+	n = 0;
+	for (digits = s; ; s++) {
+		if (*s >= '0' && *s <= '9')
+			d = *s - '0';
+		else if (*s >= 'a' && *s <= 'f')
+			d = *s - 'a' + 10;
+		else if (*s >= 'A' && *s <= 'F')
+			d = *s - 'A' + 10;
+		else
+			break;
+		if (d >= base)
+			break;
+		if (n > limit || (n == limit && d > limit_d))
+			return FALSE;
+		n = n * base + d;
+	}
+	if (s == digits)
+		return FALSE;
+
+	switch (*s) {
+	case 'k':
+		mult = 1000;
+		break;
+	case 'm':
+		mult = 1000000;
+		break;
+	case 'g':
+		mult = 1000000000;
+		break;
+	default:
+		mult = 1;
+		break;
+	}
+	if (mult != 1) {
+		if (n > max / mult)
+			return FALSE;
+		n *= mult;
+		s++;
+	}
+	if (*s)
+		return FALSE;
+	*out = n;
+
+	return TRUE;
+}
+
+static int parse_uint32(const char *s, uint32_t *out)
+{
+	uint64_t n;
+
+	if (!parse_uint(s, UINT32_MAX, &n))
+		return FALSE;
+	*out = n;
+
+	return TRUE;
+}
+
+/*
+ * A signed 32-bit integer, as parse_uint() takes them. With '-' as a
+ * special character, the sign is a word of its own, which is in neg.
+ */
+static int parse_int32(const char *s, int neg, int32_t *out)
+{
+	uint64_t n;
+
+	if (*s == '-' && !neg) {
+		neg = TRUE;
+		s++;
+	}
+	if (!parse_uint(s, neg ? (uint64_t)INT32_MAX + 1 : INT32_MAX, &n))
+		return FALSE;
+	*out = neg ? (int32_t)-(int64_t)n : (int32_t)n;
+
+	return TRUE;
+}
+
+#if TL_CONFIG_FLOAT
+/*
+ * A float, with the same k, m or g multiplier the integers take.
+ */
+static int parse_float(const char *s, int neg, float *out)
+{
+	char *end;
+	float f;
+
+	f = strtof(s, &end);
+	if (end == s)
+		return FALSE;
+	switch (*end) {
+	case 'k':
+		f *= 1000;
+		end++;
+		break;
+	case 'm':
+		f *= 1000000;
+		end++;
+		break;
+	case 'g':
+		f *= 1000000000L;
+		end++;
+		break;
+	}
+	if (*end)
+		return FALSE;
+	*out = neg ? -f : f;
+
+	return TRUE;
+}
+#endif
+
+/*
+ * A decimal number with an optional fraction and k, m or g multiplier,
+ * as a signed fixed-point value with TL_FIXED_FRAC_BITS fractional bits.
+ * Integer arithmetic only: the multiplier shifts digits from the fraction
+ * into the integer part, and up to 9 of the remaining fraction digits are
+ * rounded to the nearest 1/TL_FIXED_ONE.
+ */
+static int parse_fixed(const char *s, int neg, int64_t *out)
+{
+	const uint64_t max = (uint64_t)INT64_MAX >> TL_FIXED_FRAC_BITS;
+	const uint64_t limit = max / 10, limit_d = max % 10;
+	const char *digits, *frac, *end;
+	uint64_t n, f, scale;
+	uint32_t d;
+	int shift, i;
+
+	if (*s == '-' && !neg) {
+		neg = TRUE;
+		s++;
+	}
+	n = 0;
+	for (digits = s; *s >= '0' && *s <= '9'; s++) {
+		d = *s - '0';
+		if (n > limit || (n == limit && d > limit_d))
+			return FALSE;
+		n = n * 10 + d;
+	}
+	frac = s;
+	if (*s == '.')
+		for (frac = ++s; *s >= '0' && *s <= '9'; s++)
+			;
+	end = s;
+	if (end == digits || (*digits == '.' && end == digits + 1))
+		return FALSE;
+
+	switch (*s) {
+	case 'k':
+		shift = 3;
+		break;
+	case 'm':
+		shift = 6;
+		break;
+	case 'g':
+		shift = 9;
+		break;
+	default:
+		shift = 0;
+		break;
+	}
+	if (shift)
+		s++;
+	if (*s)
+		return FALSE;
+
+	for (i = 0; i < shift; i++) {
+		d = frac < end ? *frac++ - '0' : 0;
+		if (n > limit || (n == limit && d > limit_d))
+			return FALSE;
+		n = n * 10 + d;
+	}
+	f = 0;
+	scale = 1;
+	for (i = 0; i < 9 && frac < end; i++) {
+		f = f * 10 + *frac++ - '0';
+		scale *= 10;
+	}
+	n = (n << TL_FIXED_FRAC_BITS) + ((f << TL_FIXED_FRAC_BITS) + scale / 2) / scale;
+	if (n > (uint64_t)INT64_MAX)
+		return FALSE;
+	*out = neg ? -(int64_t)n : (int64_t)n;
+
+	return TRUE;
+}
+
+/*
+ * Parse word as a numeric argument of the given type into arg. Returns
+ * the size of its value, or 0 if word isn't one.
+ */
+static int parse_number_arg(int arg_type, const char *word, int neg,
+		t_tokenline_arg *arg)
+{
+	switch (arg_type) {
+	case T_ARG_UINT:
+		return parse_uint32(word, &arg->u.arg_uint) ? sizeof(uint32_t) : 0;
+	case T_ARG_UINT64:
+		return parse_uint(word, UINT64_MAX, &arg->u.arg_uint64)
+			? sizeof(uint64_t) : 0;
+	case T_ARG_INT:
+		return parse_int32(word, neg, &arg->u.arg_int) ? sizeof(int32_t) : 0;
+#if TL_CONFIG_FLOAT
+	case T_ARG_FLOAT:
+		return parse_float(word, neg, &arg->u.arg_float) ? sizeof(float) : 0;
+#endif
+	case T_ARG_FIXED:
+		return parse_fixed(word, neg, &arg->u.arg_fixed) ? sizeof(int64_t) : 0;
+	default:
+		/* T_ARG_FLOAT, left out. */
+		return 0;
+	}
+}
+
+#if TL_LISTINGS
+static const char *arg_type_to_string(int arg_type)
+{
+	if (arg_type == T_ARG_UINT)
+		return "<integer>";
+	else if (arg_type == T_ARG_FLOAT)
+		return "<float>";
+	else if (arg_type == T_ARG_STRING)
+		return "<string>";
+	else if (arg_type == T_ARG_UINT64)
+		return "<integer64>";
+	else if (arg_type == T_ARG_INT)
+		return "<signed>";
+	else if (arg_type == T_ARG_FIXED)
+		return "<fixed>";
+
+	return NULL;
+}
+#endif
+
+static const t_token_index_table *index_find_table(const t_token_index *index,
+		const t_token *tokens)
+{
+	int i;
+
+	for (i = 0; i < index->num_tables; i++) {
+		if (index->tables[i].tokens == tokens)
+			return &index->tables[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * First of the table's sorted entries whose keyword doesn't sort before
+ * the word, or the table's count if there is none.
+ */
+static int index_lower_bound(const t_token_index *index,
+		const t_token_index_table *table, const char *word)
+{
+	const t_token_index_entry *entries;
+	int lo, hi, mid;
+
+	entries = index->entries + table->start;
+	lo = 0;
+	hi = table->count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strcmp(index->keywords + entries[mid].keyword, word) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Does the entry's keyword start with, but isn't, the len bytes of word? */
+static int index_is_prefix(const t_token_index *index,
+		const t_token_index_entry *entry, const char *word, int len)
+{
+	return entry->len > len
+		&& !memcmp(index->keywords + entry->keyword, word, len);
+}
+
+/*
+ * Same result as the linear scan in find_token(), but done as a binary
+ * search over the table's sorted keywords.
+ */
+static int index_find_token(const t_token_index *index,
+		const t_token_index_table *table, char *word)
+{
+	const t_token_index_entry *entries;
+	uint32_t arg_uint;
+	int lo, exact, len;
+
+	entries = index->entries + table->start;
+	lo = index_lower_bound(index, table, word);
+
+	/* Find exact match, giving table order precedence as usual. */
+	exact = -1;
+	len = strlen(word);
+	if (lo < table->count && entries[lo].len == len
+			&& !memcmp(index->keywords + entries[lo].keyword, word, len))
+		exact = entries[lo].pos;
+	if (table->arg_uint != -1 && (exact == -1 || table->arg_uint < exact)) {
+		if (parse_uint32(word, &arg_uint))
+			return table->arg_uint;
+	}
+	if (exact != -1)
+		return exact;
+
+	/* Find partial match: all candidates sort right after the word. */
+	if (lo == table->count || !index_is_prefix(index, &entries[lo], word, len))
+		return -1;
+	if (lo + 1 < table->count && index_is_prefix(index, &entries[lo + 1], word, len))
+		/* Not unique. */
+		return -1;
+
+	return entries[lo].pos;
+}
+
+static int find_token(t_tokenline *tl, const t_token *tokens, char *word)
+{
+	const t_token_dict *token_dict;
+	const t_token_index_table *table;
+	uint32_t arg_uint;
+	int token, partial, i;
+
+	if (tl->index && (table = index_find_table(tl->index, tokens)))
+		return index_find_token(tl->index, table, word);
+
+	token_dict = tl->token_dict;
+	/* Find exact match. */
+	for (i = 0; tokens[i].token; i++) {
+		token = tokens[i].token;
+		if (token == T_ARG_UINT) {
+			if (parse_uint32(word, &arg_uint))
+				return i;
+		} else if (token > T_ARG_UINT) {
+			continue;
+		} else {
+			if (!strcmp(word, token_dict[token].tokenstr))
+				return i;
+		}
+	}
+
+	/* Find partial match. */
+	partial = -1;
+	for (i = 0; tokens[i].token; i++) {
+		token = tokens[i].token;
+		if (token >= T_ARG_UINT)
+			continue;
+		if (strlen(word) >= strlen(token_dict[token].tokenstr))
+			continue;
+		if (!strncmp(word, token_dict[token].tokenstr, strlen(word))) {
+			if (partial != -1)
+				/* Not unique. */
+				return -1;
+			else
+				partial = i;
+		}
+	}
+
+	return partial;
+}
+
+/* Position of the T_ARG_STRING entry in a token table, or -1. */
+static int find_arg_string(t_tokenline *tl, const t_token *tokens)
+{
+	const t_token_index_table *table;
+	int i;
+
+	if (tl->index && (table = index_find_table(tl->index, tokens)))
+		return table->arg_string;
+
+	for (i = 0; tokens[i].token; i++) {
+		if (tokens[i].token == T_ARG_STRING)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Add a numeric argument's value, the first size bytes of arg->u, to the
+ * parsed line. Returns FALSE if buf, or args, is out of room.
+ */
+static int add_arg(t_tokenline *tl, t_tokenize_state *st,
+		const t_tokenline_arg *arg, int size)
+{
+	t_tokenline_parsed *p;
+
+	p = tl->parsed;
+#if TL_CONFIG_ARG_VIEWS
+	if (tl->arg_views) {
+		if (st->cur_arg == p->max_args)
+			return FALSE;
+		p->tokens[st->cur_tp++] = st->cur_arg;
+		p->args[st->cur_arg++].u = arg->u;
+		return TRUE;
+	}
+#endif
+	if (st->cur_bufsize + size > p->buf_size)
+		return FALSE;
+	p->tokens[st->cur_tp++] = st->cur_bufsize;
+	memcpy(p->buf + st->cur_bufsize, &arg->u, size);
+	st->cur_bufsize += size;
+
+	return TRUE;
+}
+
+/*
+ * Add a string argument, without the opening quote of a quoted word: with
+ * arg_views as a view of the word in split_buf, else copied into buf.
+ * Returns FALSE if args, or buf, is out of room.
+ */
+static int add_arg_string(t_tokenline *tl, t_tokenize_state *st,
+		const char *word)
+{
+	t_tokenline_parsed *p;
+	int quoted, size;
+
+	p = tl->parsed;
+	quoted = word[0] == '"';
+#if TL_CONFIG_ARG_VIEWS
+	if (tl->arg_views) {
+		if (st->cur_arg == p->max_args)
+			return FALSE;
+		p->tokens[st->cur_tp++] = st->cur_arg;
+		p->args[st->cur_arg].u.arg_string = word + quoted;
+		p->args[st->cur_arg++].len = strlen(word + quoted);
+		return TRUE;
+	}
+#endif
+	size = strlen(word + quoted) + 1;
+	if (st->cur_bufsize + size + 1 + quoted > p->buf_size)
+		return FALSE;
+	p->tokens[st->cur_tp++] = st->cur_bufsize + quoted;
+	memcpy(p->buf + st->cur_bufsize + quoted, word + quoted, size);
+	st->cur_bufsize += size;
+	p->buf[st->cur_bufsize] = 0;
+
+	return TRUE;
+}
+
+static void tokenize_start(t_tokenline *tl, t_tokenize_state *st)
+{
+	st->token_stack[0] = tl->token_levels[tl->token_level];
+	st->cur_tsp = 0;
+	st->cur_tp = 0;
+	st->cur_bufsize = 0;
+	st->cur_arg = 0;
+	st->arg_needed = 0;
+	st->arg_tokens = NULL;
+	st->done = FALSE;
+	st->handler = NULL;
+}
+
+/*
+ * Tokenize words first..num_words-1 of the current set of NULL-terminated
+ * words, allowing for one token sublevel starting from the current token
+ * level. Parsing continues from, and updates, the state in st.
+ */
+static int tokenize(t_tokenline *tl, t_tokenize_state *st, int *words,
+		int first, int num_words, const t_token **complete_tokens, int *complete_arg)
+{
+	t_tokenline_parsed *p;
+	t_tokenline_arg arg;
+	uint32_t suffix_uint;
+	int w, t, t_idx, size, col, silent, neg, i;
+	char *word, *suffix, *s;
+
+	p = tl->parsed;
+	/* Completion tries partial lines, errors are expected. */
+	silent = complete_tokens != NULL;
+	for (w = first; w < num_words; w++) {
+		word = tl->split_buf + words[w];
+		if (st->done) {
+			return error(tl, TL_ERR_TOO_MANY_ARGUMENTS, silent);
+		} else if (!st->arg_needed) {
+			/* Token needed. */
+			if ((suffix = strchr(word, TL_TOKEN_DELIMITER))) {
+				*suffix++ = 0;
+				if (!parse_uint32(suffix, &suffix_uint))
+					return error(tl, TL_ERR_INVALID_NUMBER, FALSE);
+			} else {
+				suffix_uint = 0;
+			}
+
+			PROFILE(tl, TL_PHASE_FIND_TOKEN,
+					t_idx = find_token(tl, st->token_stack[st->cur_tsp], word));
+			if (t_idx > -1 && word[0] != '"') {
+				t = st->token_stack[st->cur_tsp][t_idx].token;
+				if (!(st->cur_tp + 1 < p->max_tokens)){
+					return error(tl, TL_ERR_TOO_MANY_WORDS, FALSE);
+				}
+				p->tokens[st->cur_tp++] = t;
+				if (t == T_ARG_UINT) {
+					/* Integer token. */
+					parse_uint32(word, &arg.u.arg_uint);
+					if (!(st->cur_tp + 1 < p->max_tokens)){
+						return error(tl, TL_ERR_TOO_MANY_WORDS, FALSE);
 					}
-					p->tokens[cur_tp++] = cur_bufsize;
-					memcpy(p->buf + cur_bufsize, &arg_uint, sizeof(uint32_t));
-					cur_bufsize += sizeof(uint32_t);
+					if (!add_arg(tl, st, &arg, sizeof(uint32_t)))
+						return error(tl, TL_ERR_TOO_MANY_ARGUMENTS, FALSE);
 				}
 				if (suffix) {
-					if (!(token_stack[cur_tsp][t_idx].flags &
+					if (!(st->token_stack[st->cur_tsp][t_idx].flags &
 							T_FLAG_SUFFIX_TOKEN_DELIM_INT)) {
-						if (!complete_tokens)
-							tl->print(tl->user, "Token suffix not allowed."NL);
-						return FALSE;
+						return error(tl, TL_ERR_SUFFIX_NOT_ALLOWED, silent);
 					}
 					if (suffix_uint > 1) {
-						if (!(cur_tp + 2 < TL_MAX_WORDS)){
-							tl->print(tl->user, "Too many words."NL);
-							return FALSE;
+						if (!(st->cur_tp + 2 < p->max_tokens)){
+							return error(tl, TL_ERR_TOO_MANY_WORDS, FALSE);
 						}
-						p->tokens[cur_tp++] = T_ARG_TOKEN_SUFFIX_INT;
-						p->tokens[cur_tp++] = cur_bufsize;
-						memcpy(p->buf + cur_bufsize, &suffix_uint, sizeof(uint32_t));
-						cur_bufsize += sizeof(uint32_t);
+						p->tokens[st->cur_tp++] = T_ARG_TOKEN_SUFFIX_INT;
+						arg.u.arg_uint = suffix_uint;
+						if (!add_arg(tl, st, &arg, sizeof(uint32_t)))
+							return error(tl, TL_ERR_TOO_MANY_ARGUMENTS, FALSE);
 						*(suffix-1) = TL_TOKEN_DELIMITER;
 					}
 				}
-				p->last_token_entry = &token_stack[cur_tsp][t_idx];
+				p->last_token_entry = &st->token_stack[st->cur_tsp][t_idx];
+				if (p->last_token_entry->handler)
+					st->handler = p->last_token_entry->handler;
 
-				if (token_stack[cur_tsp][t_idx].arg_type == T_ARG_HELP) {
+				if (st->token_stack[st->cur_tsp][t_idx].arg_type == T_ARG_HELP) {
 					/* Nothing to do, just keep cur_tsp from increasing. */
-				} else if (token_stack[cur_tsp][t_idx].arg_type) {
+				} else if (st->token_stack[st->cur_tsp][t_idx].arg_type) {
 					/* Token needs an argument */
-					arg_needed = token_stack[cur_tsp][t_idx].arg_type;
-					if (arg_needed == T_ARG_TOKEN)
+					st->arg_needed = st->token_stack[st->cur_tsp][t_idx].arg_type;
+					if (st->arg_needed == T_ARG_TOKEN)
 						/* Argument is one of these subtokens. */
-						arg_tokens = token_stack[cur_tsp][t_idx].subtokens;
-				} else if (token_stack[cur_tsp][t_idx].subtokens) {
+						st->arg_tokens = st->token_stack[st->cur_tsp][t_idx].subtokens;
+				} else if (st->token_stack[st->cur_tsp][t_idx].subtokens) {
 					/* Switch to a new token set. */
-					token_stack[cur_tsp + 1] = token_stack[cur_tsp][t_idx].subtokens;
-					cur_tsp++;
+					if (st->cur_tsp + 1 == TL_MAX_TOKEN_DEPTH) {
+						return error(tl, TL_ERR_TOO_MANY_WORDS, FALSE);
+					}
+					st->token_stack[st->cur_tsp + 1] = st->token_stack[st->cur_tsp][t_idx].subtokens;
+					st->cur_tsp++;
 				} else {
 					/* Not expecting any more arguments or tokens. */
-					done = tl->one_command_per_line;
+					st->done = tl->one_command_per_line;
 				}
 			} else {
 				/*
 				 * No matching token found, but maybe the token
 				 * set allows freeform strings?
 				 */
-				for (i = 0; token_stack[cur_tsp][i].token; i++) {
-					if (token_stack[cur_tsp][i].token == T_ARG_STRING)
-						break;
-				}
-				if (token_stack[cur_tsp][i].token) {
+				if (find_arg_string(tl, st->token_stack[st->cur_tsp]) != -1) {
 					/* Add it in as a token. */
 					if (word[0] == '"' && word[1] != 0) {
-						if (!(cur_tp + 2 < TL_MAX_WORDS)){
-							tl->print(tl->user, "Too many words."NL);
-							return FALSE;
+						if (!(st->cur_tp + 2 < p->max_tokens)){
+							return error(tl, TL_ERR_TOO_MANY_WORDS, FALSE);
 						}
-						p->tokens[cur_tp++] = T_ARG_STRING;
-						p->tokens[cur_tp++] = cur_bufsize + 1;
-						size = strlen(word + 1) + 1;
-						memcpy(p->buf + cur_bufsize + 1, word + 1, size);
-						cur_bufsize += size;
-						p->buf[cur_bufsize] = 0;
+						p->tokens[st->cur_tp++] = T_ARG_STRING;
+						if (!add_arg_string(tl, st, word))
+							return error(tl, TL_ERR_TOO_MANY_ARGUMENTS, FALSE);
 					} else if (word[0] == '"' && word[1] == 0){
-						cur_bufsize += 2;
+						st->cur_bufsize += 2;
 					} else {
-						tl->print(tl->user, "Invalid command."NL);
+						error(tl, TL_ERR_INVALID_COMMAND, FALSE);
+						if (tl->batch)
+							return FALSE;
+						col = 0;
 						for (i = 0; i < num_words; i++) {
-							tl->print(tl->user, tl->buf + words[i]);
-							if (*(tl->buf + words[i])  == '"') {
-								tl->print(tl->user, "\"");
-							}
-							tl->print(tl->user, " ");
-						}
-						tl->print(tl->user, NL);
-						for(i = 0; i < words[w]; i++) {
-							tl->print(tl->user, "-");
+							s = tl->split_buf + words[i];
+							output(tl, s);
+							if (*s == '"')
+								output(tl, "\"");
+							output(tl, " ");
+							if (i < w)
+								col += strlen(s) + (*s == '"') + 1;
 						}
-						tl->print(tl->user, "^"NL);
+						output(tl, NL);
+						for (i = 0; i < col; i++)
+							output(tl, "-");
+						output(tl, "^"NL);
 						return FALSE;
 					}
 				} else {
-					if (!complete_tokens)
-						tl->print(tl->user, "Invalid command."NL);
-					return FALSE;
+					return error(tl, TL_ERR_INVALID_COMMAND, silent);
 				}
 			}
 		} else {
 			/* Parse word as the type in arg_needed */
-			switch (arg_needed) {
+			switch (st->arg_needed) {
 			case T_ARG_UINT:
-				if( str_to_uint(word, &arg_uint, &suffix) == FALSE)
-				{
-					if (!complete_tokens)
-						tl->print(tl->user, "Invalid value."NL);
-					return FALSE;
-				}
-				if (suffix) {
-					switch(*suffix)
-					{
-					case 'k':
-						arg_uint *= 1000;
-						break;
-					case 'm':
-						arg_uint *= 1000000;
-						break;
-					case 'g':
-						arg_uint *= 1000000000L;
-						break;
-					default:
-						if (!complete_tokens)
-							tl->print(tl->user, "Invalid value."NL);
-						return FALSE;
-					}
-				}
-				if (!(cur_tp + 2 < TL_MAX_WORDS)){
-					tl->print(tl->user, "Too many words."NL);
-					return FALSE;
-				}
-				p->tokens[cur_tp++] = T_ARG_UINT;
-				p->tokens[cur_tp++] = cur_bufsize;
-				memcpy(p->buf + cur_bufsize, &arg_uint, sizeof(uint32_t));
-				cur_bufsize += sizeof(uint32_t);
-				break;
+			case T_ARG_UINT64:
+			case T_ARG_INT:
 			case T_ARG_FLOAT:
-				arg_float = strtof(word, &suffix);
-				if( arg_float == 0.0F )
-				{
-					if (!complete_tokens)
-						tl->print(tl->user, "Invalid value."NL);
-					return FALSE;
-				}
-				if (*suffix) {
-					if( strlen(suffix) > 1 )
-					{
-						if (!complete_tokens)
-							tl->print(tl->user, "Invalid value."NL);
-						return FALSE;
-					}
-					switch(*suffix)
-					{
-					case 'k':
-						arg_float *= 1000;
-						break;
-					case 'm':
-						arg_float *= 1000000;
-						break;
-					case 'g':
-						arg_float *= 1000000000L;
-						break;
-					default:
-						if (!complete_tokens)
-							tl->print(tl->user, "Invalid value."NL);
-						return FALSE;
-					}
+			case T_ARG_FIXED:
+				neg = FALSE;
+				if (st->arg_needed != T_ARG_UINT && st->arg_needed != T_ARG_UINT64
+						&& !strcmp(word, "-") && w + 1 < num_words) {
+					/* The sign was split off as a special character. */
+					neg = TRUE;
+					word = tl->split_buf + words[++w];
 				}
-				if (!(cur_tp + 2 < TL_MAX_WORDS)){
-					tl->print(tl->user, "Too many words."NL);
-					return FALSE;
+				if (!(size = parse_number_arg(st->arg_needed, word, neg, &arg)))
+					return error(tl, TL_ERR_INVALID_VALUE, silent);
+				if (!(st->cur_tp + 2 < p->max_tokens)){
+					return error(tl, TL_ERR_TOO_MANY_WORDS, FALSE);
 				}
-				p->tokens[cur_tp++] = T_ARG_FLOAT;
-				p->tokens[cur_tp++] = cur_bufsize;
-				memcpy(p->buf + cur_bufsize, &arg_float, sizeof(float));
-				cur_bufsize += sizeof(float);
+				p->tokens[st->cur_tp++] = st->arg_needed;
+				if (!add_arg(tl, st, &arg, size))
+					return error(tl, TL_ERR_TOO_MANY_ARGUMENTS, FALSE);
 				break;
 			case T_ARG_STRING:
-				if (!(cur_tp + 2 < TL_MAX_WORDS)){
-					tl->print(tl->user, "Too many words."NL);
-					return FALSE;
+				if (!(st->cur_tp + 2 < p->max_tokens)){
+					return error(tl, TL_ERR_TOO_MANY_WORDS, FALSE);
 				}
-				p->tokens[cur_tp++] = T_ARG_STRING;
-				if (word[0] != '"') {
-					p->tokens[cur_tp++] = cur_bufsize;
-					size = strlen(word) + 1;
-					memcpy(p->buf + cur_bufsize, word, size);
-				} else {
-					p->tokens[cur_tp++] = cur_bufsize + 1;
-					size = strlen(word + 1) + 1;
-					memcpy(p->buf + cur_bufsize + 1, word + 1, size);
-				}
-				cur_bufsize += size;
-				p->buf[cur_bufsize] = 0;
+				p->tokens[st->cur_tp++] = T_ARG_STRING;
+				if (!add_arg_string(tl, st, word))
+					return error(tl, TL_ERR_TOO_MANY_ARGUMENTS, FALSE);
 				break;
 			case T_ARG_TOKEN:
-				if ((t_idx = find_token(arg_tokens, tl->token_dict, word)) > -1) {
-					if (!(cur_tp + 1 < TL_MAX_WORDS)){
-						tl->print(tl->user, "Too many words."NL);
-						return FALSE;
+				if ((t_idx = find_token(tl, st->arg_tokens, word)) > -1) {
+					if (!(st->cur_tp + 1 < p->max_tokens)){
+						return error(tl, TL_ERR_TOO_MANY_WORDS, FALSE);
 					}
-					p->tokens[cur_tp++] = arg_tokens[t_idx].token;
-					p->last_token_entry = &arg_tokens[t_idx];
+					p->tokens[st->cur_tp++] = st->arg_tokens[t_idx].token;
+					p->last_token_entry = &st->arg_tokens[t_idx];
+					if (p->last_token_entry->handler)
+						st->handler = p->last_token_entry->handler;
 				} else {
-					if (!complete_tokens)
-						tl->print(tl->user, "Invalid value."NL);
-					return FALSE;
+					return error(tl, TL_ERR_INVALID_VALUE, silent);
 				}
 				break;
 			}
-			arg_needed = 0;
-			done = tl->one_command_per_line;
+			st->arg_needed = 0;
+			st->done = tl->one_command_per_line;
 		}
 	}
-	if (arg_needed && !complete_tokens) {
-		tl->print(tl->user, "Missing argument."NL);
-		return FALSE;
-	}
+	if (st->arg_needed && !complete_tokens)
+		return error(tl, TL_ERR_MISSING_ARGUMENT, FALSE);
 
-	p->tokens[cur_tp] = 0;
+	p->tokens[st->cur_tp] = 0;
+	p->num_tokens = st->cur_tp + 1;
+	p->buf_len = st->cur_bufsize < p->buf_size ? st->cur_bufsize + 1 : p->buf_size;
+#if TL_CONFIG_ARG_VIEWS
+	p->num_args = st->cur_arg;
+#endif
+	p->handler = st->handler;
 
 	if (complete_tokens) {
-		if (done) {
+		if (st->done) {
 			/* Nothing to add. */
 			*complete_tokens = NULL;
 		} else {
 			/* Fill in the completion token list. */
-			if (arg_needed == T_ARG_TOKEN)
-				*complete_tokens = arg_tokens;
+			if (st->arg_needed == T_ARG_TOKEN)
+				*complete_tokens = st->arg_tokens;
 			else
-				*complete_tokens = token_stack[cur_tsp];
+				*complete_tokens = st->token_stack[st->cur_tsp];
 		}
 	}
 	if (complete_arg)
-		*complete_arg = arg_needed;
+		*complete_arg = st->arg_needed;
 
 	return TRUE;
 }
 
-static void show_help(t_tokenline *tl, int *words, int num_words)
+#if TL_LISTINGS
+static const char *token_name(t_tokenline *tl, const t_token *token)
 {
-	t_token *tokens;
-	int i;
-	char *s;
+	if (token->token < T_ARG_UINT)
+		return tl->token_dict[token->token].tokenstr;
+	else
+		return arg_type_to_string(token->token);
+}
 
-	(void)words;
+/* Width of the keyword column for listing tokens. */
+static int list_width(t_tokenline *tl, const t_token *tokens)
+{
+	int width, len, t;
 
-	if (tl->parsed.last_token_entry) {
-		if (tl->parsed.last_token_entry->help_full) {
-			tl->print(tl->user, tl->parsed.last_token_entry->help_full);
-			tl->print(tl->user, NL);
-		} else if (tl->parsed.last_token_entry->help) {
-			tl->print(tl->user, tl->parsed.last_token_entry->help);
-			tl->print(tl->user, NL);
-		}
+	width = HELP_COLUMN;
+	for (t = 0; tokens[t].token; t++) {
+		len = strlen(token_name(tl, &tokens[t])) + 2;
+		if (len > width)
+			width = len;
 	}
 
-	if (num_words == 1) {
-		/* Just "help" -- global command overview. */
-		tokens = tl->token_levels[tl->token_level];
-	} else {
-		if (tl->parsed.last_token_entry) {
-			tokens = tl->parsed.last_token_entry->subtokens;
-		} else {
-			tokens = NULL;
-		}
-	}
+	return width;
+}
+#endif
 
-	if (tokens) {
-		for (i = 0; tokens[i].token; i++) {
-			tl->print(tl->user, INDENT);
-			if (tokens[i].token < T_ARG_UINT)
-				s = tl->token_dict[tokens[i].token].tokenstr;
-			else
-				s = arg_type_to_string(tokens[i].token);
-			tl->print(tl->user, s);
-			if (tokens[i].help) {
-				tl->print(tl->user, space + strlen(s));
-				tl->print(tl->user, tokens[i].help);
+#if TL_LISTINGS || TL_MAX_ALIASES
+static void output_pad(t_tokenline *tl, int n)
+{
+	int size;
+
+	while (n > 0) {
+		size = n < (int)sizeof(space) - 1 ? n : (int)sizeof(space) - 1;
+		output_len(tl, space, size);
+		n -= size;
+	}
+}
+#endif
+
+#if TL_LISTINGS
+/* The keyword padded to width, and its help. */
+static void print_token_and_help(t_tokenline *tl, const t_token *token,
+		int width)
+{
+	const char *s;
+
+	s = token_name(tl, token);
+	output(tl, INDENT);
+	output(tl, s);
+	if (token->help) {
+		output_pad(tl, width - strlen(s));
+		output(tl, token->help);
+	}
+}
+
+/*
+ * The token listings of help and Tab. Returns FALSE when it ran out of
+ * room, see job_room().
+ */
+static int list_run(t_tokenline *tl)
+{
+	const t_token *token;
+	int len;
+
+	for (; tl->job.tokens[tl->job.pos].token; tl->job.pos++) {
+		token = &tl->job.tokens[tl->job.pos];
+		/* What print_token_and_help() outputs, at most. */
+		len = strlen(INDENT) + tl->job.width + strlen(NL);
+		if (token->help)
+			len += strlen(token->help);
+		if (!job_room(tl, len))
+			return FALSE;
+		print_token_and_help(tl, token, tl->job.width);
+		output(tl, NL);
+	}
+
+	return TRUE;
+}
+
+static void list_start(t_tokenline *tl, int type, const t_token *tokens)
+{
+	tl->job.type = type;
+	tl->job.tokens = tokens;
+	tl->job.pos = 0;
+	tl->job.width = list_width(tl, tokens);
+	job_run(tl);
+}
+#endif
+
+#if TL_CONFIG_HELP
+static void show_help(t_tokenline *tl, int *words, int num_words)
+{
+	const t_token *tokens;
+
+	(void)words;
+
+	if (tl->parsed->last_token_entry) {
+		if (tl->parsed->last_token_entry->help_full) {
+			output(tl, tl->parsed->last_token_entry->help_full);
+			output(tl, NL);
+		} else if (tl->parsed->last_token_entry->help) {
+			output(tl, tl->parsed->last_token_entry->help);
+			output(tl, NL);
+		}
+	}
+
+	if (num_words == 1) {
+		/* Just "help" -- global command overview. */
+		tokens = tl->token_levels[tl->token_level];
+	} else {
+		if (tl->parsed->last_token_entry) {
+			tokens = tl->parsed->last_token_entry->subtokens;
+		} else {
+			tokens = NULL;
+		}
+	}
+
+	if (tokens) {
+		list_start(tl, JOB_HELP, tokens);
+	} else if (!tl->parsed->last_token_entry
+			|| !tl->parsed->last_token_entry->help) {
+		output(tl, NO_HELP);
+	}
+}
+#endif
+
+#if TL_MAX_ALIASES
+/* The commands an alias runs, past its name. */
+static const char *alias_commands(const t_tokenline_alias *a)
+{
+	return a->line + strlen(a->line) + 1;
+}
+
+/* The alias command's listing. Returns FALSE when it ran out of room. */
+static int alias_list_run(t_tokenline *tl)
+{
+	const t_tokenline_alias *a;
+	int len;
+
+	for (; tl->job.pos < TL_MAX_ALIASES; tl->job.pos++) {
+		a = &tl->aliases[tl->job.pos];
+		if (!a->line[0])
+			continue;
+		len = strlen(a->line);
+		if (!job_room(tl, strlen(INDENT) + len + HELP_COLUMN
+				+ strlen(alias_commands(a)) + strlen(NL)))
+			return FALSE;
+		output(tl, INDENT);
+		output(tl, a->line);
+		output_pad(tl, len < HELP_COLUMN ? HELP_COLUMN - len : 1);
+		output(tl, alias_commands(a));
+		output(tl, NL);
+	}
+
+	return TRUE;
+}
+#endif
+
+/*
+ * Carry on with the suspended built-in command or listing. Returns TRUE
+ * once it's done.
+ */
+static int job_run(t_tokenline *tl)
+{
+	int done;
+
+	switch (tl->job.type) {
+#if TL_CONFIG_HISTORY
+	case JOB_HISTORY:
+		done = history_run(tl);
+		break;
+#endif
+#if TL_LISTINGS
+	case JOB_HELP:
+	case JOB_LIST:
+		done = list_run(tl);
+		break;
+#endif
+#if TL_MAX_ALIASES
+	case JOB_ALIAS:
+		done = alias_list_run(tl);
+		break;
+#endif
+	default:
+		done = TRUE;
+		break;
+	}
+	if (done) {
+		if (tl->job.type == JOB_LIST) {
+			/* Back to the line being completed. */
+			output(tl, tl->prompt);
+			output(tl, tl->buf);
+		}
+		tl->job.type = JOB_NONE;
+	}
+
+	return done;
+}
+
+/* Hand a tokenized command to its handler, or the callback. */
+static void dispatch(t_tokenline *tl, t_tokenline_parsed *p)
+{
+	/* Keep our output ahead of whatever the callback prints. */
+	tl_flush(tl);
+	if (p->handler)
+		PROFILE(tl, TL_PHASE_CALLBACK, p->handler(tl->user, p));
+	else if (tl->callback)
+		PROFILE(tl, TL_PHASE_CALLBACK, tl->callback(tl->user, p));
+}
+
+/*
+ * repeat <count> [command]: tokenize the command once, and dispatch it
+ * count times. Without a command, the previous one in the history is
+ * used (the last one, if that line has several). Batch lines aren't in
+ * the history, so there is none in batch mode.
+ */
+static int repeat_command(t_tokenline *tl)
+{
+	t_tokenize_state st;
+#if TL_CONFIG_HISTORY
+	t_history_entry *entry;
+	int start, i;
+	char *line;
+#endif
+	uint32_t count;
+	int first, ret;
+
+	if (tl->num_words < 2
+			|| !parse_uint32(tl->split_buf + tl->words[1], &count))
+		return error(tl, TL_ERR_INVALID_COUNT, FALSE);
+
+	first = 2;
+#if !TL_CONFIG_HISTORY
+	if (tl->num_words == 2)
+		return error(tl, TL_ERR_NO_PREVIOUS_COMMAND, FALSE);
+#else
+	if (tl->num_words == 2) {
+		/* Skip this line if it made it into the history. */
+		i = tl->batch ? -1 : history_before_line(tl);
+		/* And any other bare repeats before it. */
+		for (; i >= 0; i--) {
+			entry = history_entry(tl, i);
+			line = tl->hist_buf + entry->offset;
+			start = last_command(tl, line, entry->len);
+			if (!split_line_from(tl, line, entry->len, start, 0, 0, TRUE)
+					|| !tl->num_words)
+				continue;
+			if (strcmp(tl->split_buf + tl->words[0], "repeat")) {
+				first = 0;
+				break;
 			}
-			tl->print(tl->user, NL);
+			if (tl->num_words > 2)
+				break;
 		}
+		if (i < 0)
+			return error(tl, TL_ERR_NO_PREVIOUS_COMMAND, FALSE);
 	}
-	if ((!tl->parsed.last_token_entry || !tl->parsed.last_token_entry->help)
-			&& !tokens)
-		tl->print(tl->user, NO_HELP);
+#endif
+
+	tokenize_start(tl, &st);
+	PROFILE(tl, TL_PHASE_TOKENIZE,
+			ret = tokenize(tl, &st, tl->words, first, tl->num_words, NULL, NULL));
+	if (!ret)
+		return FALSE;
+	while (count--)
+		dispatch(tl, tl->parsed);
+
+	return TRUE;
 }
 
-static void process_line(t_tokenline *tl)
+#ifdef TL_PROFILE
+/* Output n right-aligned in a column of width characters. */
+static void output_column(t_tokenline *tl, uint32_t n, int width)
 {
-	t_token *tokens;
-	int words[TL_MAX_WORDS], num_words, i;
+	char s[10];
+	int len;
 
-	tl->print(tl->user, NL);
-	do {
-		if (!tl->buf_len)
-			break;
-		history_add(tl);
-		if (!split_line(tl, words, &num_words, FALSE))
-			break;
-		if (!num_words)
+	len = format_uint(s, n);
+	while (len < width--)
+		output(tl, " ");
+	output_len(tl, s, len);
+}
+
+static void stats_show(t_tokenline *tl)
+{
+	static char *phase_names[TL_NUM_PHASES] = {
+		"split", "tokenize", "find_token", "callback", "print",
+	};
+	t_phase_stats *ps;
+	int i;
+
+	output(tl, "phase            count      cycles         max"NL);
+	for (i = 0; i < TL_NUM_PHASES; i++) {
+		ps = &tl->stats.phases[i];
+		output(tl, phase_names[i]);
+		output_column(tl, ps->count, 21 - strlen(phase_names[i]));
+		output_column(tl, ps->total, 12);
+		output_column(tl, ps->max, 12);
+		output(tl, NL);
+	}
+	output(tl, "lines");
+	output_column(tl, tl->stats.lines, 16);
+	output(tl, NL"bytes");
+	output_column(tl, tl->stats.line_bytes, 16);
+	output(tl, NL"bytes/line max");
+	output_column(tl, tl->stats.line_bytes_max, 7);
+	output(tl, NL);
+}
+#endif
+
+#if TL_CONFIG_ARG_VIEWS
+/*
+ * With arg_views set, the next T_ARG_STRING argument of p from position
+ * *i in its tokens on, or NULL.
+ */
+static t_tokenline_arg *next_string(t_tokenline_parsed *p, int *i)
+{
+	for (; p->tokens[*i]; (*i)++) {
+		switch (p->tokens[*i]) {
+		case T_ARG_STRING:
+			*i += 2;
+			return &p->args[p->tokens[*i - 1]];
+		case T_ARG_UINT:
+		case T_ARG_FLOAT:
+		case T_ARG_TOKEN_SUFFIX_INT:
+		case T_ARG_UINT64:
+		case T_ARG_INT:
+		case T_ARG_FIXED:
+			(*i)++;
 			break;
-		if (!strcmp(tl->buf + words[0], "help")) {
-			if (num_words == 1) {
-				/*
-				 * Nothing to tokenize: find the help entry
-				 * if any so its help text can be shown.
-				 */
-				tokens = tl->token_levels[tl->token_level];
-				for (i = 0; tokens[i].token; i++) {
-					if (tokens[i].arg_type == T_ARG_HELP) {
-						tl->parsed.last_token_entry = &tokens[i];
-						break;
-					}
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+#if TL_MAX_ALIASES
+static int exec_line(t_tokenline *tl, const char *line, int len);
+
+/*
+ * An alias runs a line of commands under a name of its own. The first
+ * time it runs, what its commands tokenize to is kept in its cache, so
+ * later runs dispatch them from there without splitting or tokenizing.
+ * The cache is a t_alias_record per command, followed by its tokens, then
+ * its buf bytes, or with arg_views its args and the strings they point to.
+ */
+typedef struct {
+	/* Table the command was tokenized against. */
+	const t_token *tokens;
+	const t_token *last_token_entry;
+	tl_handler handler;
+	/* Offset of the command in the alias' commands. */
+	uint16_t offset;
+	uint16_t num_tokens;
+	/* Bytes of buf, or args. */
+	uint16_t num_data;
+} t_alias_record;
+
+static t_tokenline_alias *alias_find(t_tokenline *tl, const char *name)
+{
+	int i;
+
+	for (i = 0; i < TL_MAX_ALIASES; i++) {
+		if (tl->aliases[i].line[0] && !strcmp(tl->aliases[i].line, name))
+			return &tl->aliases[i];
+	}
+
+	return NULL;
+}
+
+/* Append to the cache being filled, or give up on it if it's full. */
+static void cache_put(t_tokenline_alias *a, const void *data, int len)
+{
+	if (a->cache_len < 0)
+		return;
+	if (a->cache_len + len > TL_ALIAS_CACHE_SIZE) {
+		a->cache_len = -1;
+		return;
+	}
+	memcpy(a->cache + a->cache_len, data, len);
+	a->cache_len += len;
+}
+
+/* Keep the command at line, just tokenized, in the alias' cache. */
+static void alias_cache_add(t_tokenline *tl, const t_tokenize_state *st,
+		const char *line)
+{
+	t_tokenline_alias *a;
+	t_tokenline_parsed *p;
+	t_alias_record rec;
+#if TL_CONFIG_ARG_VIEWS
+	t_tokenline_arg *arg;
+	int i;
+#endif
+
+	a = tl->alias_caching;
+	p = tl->parsed;
+	rec.tokens = st->token_stack[0];
+	rec.last_token_entry = p->last_token_entry;
+	rec.handler = p->handler;
+	rec.offset = line - alias_commands(a);
+	rec.num_tokens = p->num_tokens;
+	rec.num_data = p->buf_len;
+#if TL_CONFIG_ARG_VIEWS
+	if (tl->arg_views)
+		rec.num_data = p->num_args;
+#endif
+	cache_put(a, &rec, sizeof(rec));
+	cache_put(a, p->tokens, rec.num_tokens * sizeof(int));
+#if TL_CONFIG_ARG_VIEWS
+	if (tl->arg_views) {
+		cache_put(a, p->args, rec.num_data * sizeof(t_tokenline_arg));
+		i = 0;
+		while ((arg = next_string(p, &i)))
+			cache_put(a, arg->u.arg_string, arg->len + 1);
+		return;
+	}
+#endif
+	cache_put(a, p->buf, rec.num_data);
+}
+
+/*
+ * Unpack the cached command following rec, at pos in the cache, into
+ * tl->parsed. Returns the position of the next one.
+ */
+static int alias_cache_get(t_tokenline *tl, const t_tokenline_alias *a,
+		const t_alias_record *rec, int pos)
+{
+	t_tokenline_parsed *p;
+#if TL_CONFIG_ARG_VIEWS
+	t_tokenline_arg *arg;
+	int offset, i;
+#endif
+
+	p = tl->parsed;
+	p->last_token_entry = rec->last_token_entry;
+	p->handler = rec->handler;
+	p->num_tokens = rec->num_tokens;
+	memcpy(p->tokens, a->cache + pos, rec->num_tokens * sizeof(int));
+	pos += rec->num_tokens * sizeof(int);
+#if TL_CONFIG_ARG_VIEWS
+	if (tl->arg_views) {
+		p->num_args = rec->num_data;
+		memcpy(p->args, a->cache + pos, rec->num_data * sizeof(t_tokenline_arg));
+		pos += rec->num_data * sizeof(t_tokenline_arg);
+		offset = 0;
+		i = 0;
+		while ((arg = next_string(p, &i))) {
+			memcpy(p->buf + offset, a->cache + pos, arg->len + 1);
+			arg->u.arg_string = p->buf + offset;
+			offset += arg->len + 1;
+			pos += arg->len + 1;
+		}
+		p->buf_len = offset;
+		return pos;
+	}
+#endif
+	p->buf_len = rec->num_data;
+	memcpy(p->buf, a->cache + pos, rec->num_data);
+	pos += rec->num_data;
+
+	return pos;
+}
+
+/*
+ * Run an alias' commands from its cache if it's valid, and for real,
+ * filling the cache, if not. A command that finds another table than the
+ * one it was tokenized against, because a handler switched modes
+ * differently than when the cache was filled, has the rest run for real.
+ * Commands in an alias can't use aliases. A built-in command in it that's
+ * suspended leaves the rest of the alias to alias_resume().
+ */
+static void alias_run(t_tokenline *tl, t_tokenline_alias *a)
+{
+	t_alias_record rec;
+	const char *commands;
+	int len, pos;
+
+	commands = alias_commands(a);
+	len = strlen(commands);
+	tl->alias_running = TRUE;
+	if (a->cache_gen == tl->alias_gen
+#if TL_CONFIG_ARG_VIEWS
+			&& a->cache_views == tl->arg_views
+#endif
+			) {
+		for (pos = 0; pos < a->cache_len; ) {
+			memcpy(&rec, a->cache + pos, sizeof(rec));
+			if (rec.tokens != tl->token_levels[tl->token_level]) {
+				a->cache_gen = 0;
+				exec_line(tl, commands + rec.offset, len - rec.offset);
+				break;
+			}
+			pos = alias_cache_get(tl, a, &rec, pos + sizeof(rec));
+			dispatch(tl, tl->parsed);
+		}
+	} else {
+		a->cache_len = 0;
+#if TL_CONFIG_ARG_VIEWS
+		a->cache_views = tl->arg_views;
+#endif
+		tl->alias_caching = a;
+		exec_line(tl, commands, len);
+		tl->alias_caching = NULL;
+		if (a->cache_len >= 0 && tl->status == TL_OK)
+			a->cache_gen = tl->alias_gen;
+	}
+	tl->alias_running = FALSE;
+}
+
+/*
+ * Run the rest of an alias' commands, once the built-in command that was
+ * suspended in it is done. Like the alias itself, failing stops the line.
+ */
+static void alias_resume(t_tokenline *tl)
+{
+	const char *rest;
+
+	rest = tl->job.alias_rest;
+	tl->alias_running = TRUE;
+	exec_line(tl, rest, strlen(rest));
+	tl->alias_running = FALSE;
+	if (tl->status != TL_OK)
+		tl->job.rest = -1;
+}
+
+/*
+ * alias <name> <commands>: the commands are the rest of the words, or the
+ * contents of a single quoted one, which can hold several commands.
+ */
+static void alias_define(t_tokenline *tl, int *words, int num_words)
+{
+	t_tokenline_alias *a;
+	const char *name, *s;
+	int quoted, len, i;
+	char *out;
+
+	name = tl->split_buf + words[1];
+	if (*name == '"') {
+		error(tl, TL_ERR_INVALID_COMMAND, FALSE);
+		return;
+	}
+	if (!(a = alias_find(tl, name))) {
+		for (i = 0; i < TL_MAX_ALIASES && tl->aliases[i].line[0]; i++)
+			;
+		if (i == TL_MAX_ALIASES) {
+			error(tl, TL_ERR_TOO_MANY_ALIASES, FALSE);
+			return;
+		}
+		a = &tl->aliases[i];
+	}
+
+	/* A lone quoted word loses its quotes, others keep them. */
+	quoted = num_words == 3 && tl->split_buf[words[2]] == '"';
+	len = strlen(name) + 1;
+	for (i = 2; i < num_words; i++) {
+		s = tl->split_buf + words[i];
+		len += strlen(s) + 1 + (*s == '"' && !quoted);
+	}
+	if (len - quoted > TL_MAX_LINE_LEN) {
+		error(tl, TL_ERR_LINE_TOO_LONG, FALSE);
+		return;
+	}
+
+	out = a->line;
+	out += strlen(strcpy(out, name)) + 1;
+	if (quoted) {
+		strcpy(out, tl->split_buf + words[2] + 1);
+	} else {
+		for (i = 2; i < num_words; i++) {
+			s = tl->split_buf + words[i];
+			if (i > 2)
+				*out++ = ' ';
+			out += strlen(strcpy(out, s));
+			if (*s == '"')
+				*out++ = '"';
+		}
+		*out = 0;
+	}
+	a->cache_gen = 0;
+}
+
+/* alias, alias <name> <commands> and unalias <name>. */
+static void alias_command(t_tokenline *tl, int *words, int num_words)
+{
+	t_tokenline_alias *a;
+
+	if (!strcmp(tl->split_buf + words[0], "unalias")) {
+		if (num_words != 2) {
+			error(tl, TL_ERR_MISSING_ARGUMENT, FALSE);
+		} else if (!(a = alias_find(tl, tl->split_buf + words[1]))) {
+			error(tl, TL_ERR_NO_SUCH_ALIAS, FALSE);
+		} else {
+			a->line[0] = 0;
+			a->cache_gen = 0;
+		}
+	} else if (num_words == 1) {
+		tl->job.type = JOB_ALIAS;
+		tl->job.pos = 0;
+		job_run(tl);
+	} else if (num_words == 2) {
+		error(tl, TL_ERR_MISSING_ARGUMENT, FALSE);
+	} else {
+		alias_define(tl, words, num_words);
+	}
+}
+#endif
+
+/*
+ * Run the built-in command in words, if it is one. Returns FALSE if it
+ * isn't.
+ */
+static int builtin_command(t_tokenline *tl, int *words, int num_words)
+{
+#if TL_CONFIG_HELP
+	t_tokenize_state st;
+	const t_token *tokens;
+	int i;
+#endif
+	const char *cmd;
+
+#if !TL_CONFIG_HELP && !TL_MAX_ALIASES && !defined(TL_PROFILE)
+	(void)num_words;
+#endif
+	cmd = tl->split_buf + words[0];
+	if (!strcmp(cmd, "repeat")) {
+		repeat_command(tl);
+#if TL_CONFIG_HELP
+	} else if (!strcmp(cmd, "help")) {
+		if (num_words == 1) {
+			/*
+			 * Nothing to tokenize: find the help entry
+			 * if any so its help text can be shown.
+			 */
+			tokens = tl->token_levels[tl->token_level];
+			for (i = 0; tokens[i].token; i++) {
+				if (tokens[i].arg_type == T_ARG_HELP) {
+					tl->parsed->last_token_entry = &tokens[i];
+					break;
 				}
-			} else {
-				/* Tokenize with errors turned off. */
-				tokenize(tl, words + 1, num_words - 1, &tokens, NULL);
 			}
-			show_help(tl, words, num_words);
-		} else if (!strcmp(tl->buf + words[0], "history")) {
-			history_show(tl);
 		} else {
-			if (!tokenize(tl, words, num_words, NULL, NULL))
-				break;
-			if (tl->callback)
-				tl->callback(tl->user, &tl->parsed);
+			/* Tokenize with errors turned off. */
+			tokenize_start(tl, &st);
+			tokenize(tl, &st, words, 1, num_words, &tokens, NULL);
+			tl->status = TL_OK;
 		}
+		show_help(tl, words, num_words);
+#endif
+#if TL_CONFIG_HISTORY
+	} else if (!strcmp(cmd, "history")) {
+		history_show(tl);
+#endif
+#ifdef TL_PROFILE
+	} else if (!strcmp(cmd, "stats")) {
+		if (num_words == 2 && !strcmp(tl->split_buf + words[1], "reset"))
+			tl_stats_reset(tl);
+		else
+			stats_show(tl);
+#endif
+#if TL_MAX_ALIASES
+	} else if (tl->alias_running) {
+		/* Aliases are left alone while one runs. */
+		return FALSE;
+	} else if (!strcmp(cmd, "alias") || !strcmp(cmd, "unalias")) {
+		alias_command(tl, words, num_words);
+	} else if (num_words == 1 && alias_find(tl, cmd)) {
+		alias_run(tl, alias_find(tl, cmd));
+#endif
+	} else {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Split, tokenize and dispatch a single command, or run the built-in
+ * command it holds. Returns its status.
+ */
+static int exec_command(t_tokenline *tl, const char *line, int len)
+{
+	t_tokenize_state st;
+	int ret;
+
+	tl->status = TL_OK;
+	do {
+		if (!len)
+			break;
+		PROFILE(tl, TL_PHASE_SPLIT,
+				ret = split_line_from(tl, line, len, 0, 0, 0, FALSE));
+		if (!ret)
+			break;
+		if (!tl->num_words)
+			break;
+		if (builtin_command(tl, tl->words, tl->num_words)) {
+#if TL_MAX_ALIASES
+			/* Built-in commands are run for real every time. */
+			if (tl->alias_caching)
+				tl->alias_caching->cache_len = -1;
+#endif
+			break;
+		}
+		tokenize_start(tl, &st);
+		PROFILE(tl, TL_PHASE_TOKENIZE,
+				ret = tokenize(tl, &st, tl->words, 0, tl->num_words, NULL, NULL));
+		if (!ret)
+			break;
+#if TL_MAX_ALIASES
+		if (tl->alias_caching)
+			alias_cache_add(tl, &st, line);
+#endif
+		dispatch(tl, tl->parsed);
 	} while (FALSE);
 
+	return tl->status;
+}
+
+/*
+ * Run the commands on a line in order, stopping at the first one that
+ * fails, or that was suspended. Returns the status of the last one run.
+ */
+static int exec_line(t_tokenline *tl, const char *line, int len)
+{
+	int n;
+
+#if TL_MAX_ALIASES
+	tl->job.alias_rest = NULL;
+	if (!tl->alias_running)
+#endif
+		tl->job.rest = -1;
+	while (TRUE) {
+		n = command_len(tl, line, len);
+		if (exec_command(tl, line, n) != TL_OK || n == len)
+			break;
+		line += n + 1;
+		len -= n + 1;
+		if (tl->job.type) {
+			/* Suspended: the rest of the line has to wait. */
+#if TL_MAX_ALIASES
+			if (tl->alias_running)
+				tl->job.alias_rest = line;
+			else
+#endif
+				tl->job.rest = line - tl->buf;
+			break;
+		}
+	}
+
+	return tl->status;
+}
+
+/*
+ * Bursts of input, pasted or fed in one block, aren't echoed as they come
+ * in: the screen is left as it was at echo_pos, and the line is redrawn
+ * from there in one go when the burst ends, when it's run, or before
+ * anything else that needs the screen to be up to date.
+ */
+static void echo_defer(t_tokenline *tl)
+{
+	if (tl->echo_pos < 0 && !tl->batch)
+		tl->echo_pos = tl->pos;
+}
+
+static void echo_sync(t_tokenline *tl)
+{
+	if (tl->echo_pos < 0)
+		return;
+	if (tl->echo_prompt) {
+		output(tl, tl->prompt);
+		tl->echo_prompt = FALSE;
+	}
+	output(tl, tl->buf + tl->echo_pos);
+	cursor_move(tl, tl->pos - tl->buf_len);
+	tl->echo_pos = tl->pos;
+}
+
+static void echo_end(t_tokenline *tl)
+{
+	echo_sync(tl);
+	tl->echo_pos = -1;
+}
+
+/* Get ready for the next line. */
+static void line_done(t_tokenline *tl)
+{
 	tl->buf[0] = 0;
 	tl->buf_len = 0;
-	tl->escape_len = 0;
+	tl->batch_overflow = FALSE;
+	tl->escape_state = ESC_NONE;
 	tl->pos = 0;
+#if TL_CONFIG_HISTORY
 	tl->hist_step = -1;
-	tl->print(tl->user, tl->prompt);
+#endif
+	line_changed(tl, 0);
+	if (tl->echo_pos >= 0) {
+		/* Shown along with the next line, if there's one. */
+		tl->echo_pos = 0;
+		tl->echo_prompt = TRUE;
+	} else if (!tl->batch) {
+		output(tl, tl->prompt);
+	}
+#ifdef TL_PROFILE
+	tl->stats.lines++;
+	tl->stats.line_bytes += tl->cur_line_bytes;
+	if (tl->cur_line_bytes > tl->stats.line_bytes_max)
+		tl->stats.line_bytes_max = tl->cur_line_bytes;
+	tl->cur_line_bytes = 0;
+#endif
 }
 
-static void add_char_silent(t_tokenline *tl, int c)
+static void process_line(t_tokenline *tl)
 {
-	if (tl->pos == tl->buf_len) {
-		tl->buf[tl->buf_len++] = c;
-		tl->buf[tl->buf_len] = 0;
-		tl->pos++;
+	echo_sync(tl);
+	if (!tl->batch) {
+		output(tl, NL);
+#if TL_CONFIG_HISTORY
+		if (tl->buf_len)
+			history_add(tl);
+#endif
+	}
+	if (tl->batch_overflow) {
+		error(tl, TL_ERR_LINE_TOO_LONG, FALSE);
 	} else {
-		memmove(tl->buf + tl->pos + 1, tl->buf + tl->pos,
-				tl->buf_len - tl->pos + 1);
-		tl->buf[tl->pos] = c;
-		tl->buf_len++;
-		tl->pos++;
+		tl->job_resumable = TRUE;
+		exec_line(tl, tl->buf, tl->buf_len);
+		tl->job_resumable = FALSE;
+		if (tl->job.type)
+			/* job_resume() finishes the line. */
+			return;
+	}
+	line_done(tl);
+}
+
+/*
+ * Pick up a built-in command suspended for lack of room in the transmit
+ * ring, then the rest of its line, or a Tab listing. Returns FALSE while
+ * it's still suspended.
+ */
+static int job_resume(t_tokenline *tl)
+{
+	int type, done;
+
+	if (!tl->job.type)
+		return TRUE;
+	type = tl->job.type;
+	tl->job_resumable = TRUE;
+	done = job_run(tl);
+	if (type != JOB_LIST) {
+#if TL_MAX_ALIASES
+		if (done && tl->job.alias_rest) {
+			alias_resume(tl);
+			done = !tl->job.type;
+		}
+#endif
+		if (done && tl->job.rest >= 0) {
+			exec_line(tl, tl->buf + tl->job.rest, tl->buf_len - tl->job.rest);
+			done = !tl->job.type;
+		}
+		if (done)
+			line_done(tl);
 	}
+	tl->job_resumable = FALSE;
+
+	return done;
+}
+
+/* Insert len characters at the cursor. Returns how many fit. */
+static int line_insert(t_tokenline *tl, const char *chars, int len)
+{
+	if (len > tl->line_size - 1 - tl->buf_len)
+		len = tl->line_size - 1 - tl->buf_len;
+	if (len <= 0)
+		return 0;
+
+	line_changed(tl, tl->pos);
+	memmove(tl->buf + tl->pos + len, tl->buf + tl->pos,
+			tl->buf_len - tl->pos + 1);
+	memcpy(tl->buf + tl->pos, chars, len);
+	tl->buf_len += len;
+	tl->pos += len;
+
+	return len;
+}
+
+/*
+ * Insert len characters at the cursor, and echo them in one go, unless
+ * the echo is deferred.
+ */
+static void add_chars(t_tokenline *tl, const char *chars, int len)
+{
+	int pos;
+
+	pos = tl->pos;
+	if (!line_insert(tl, chars, len) || tl->echo_pos >= 0)
+		return;
+	output(tl, tl->buf + pos);
+	cursor_move(tl, tl->pos - tl->buf_len);
 }
 
 static void add_char(t_tokenline *tl, int c)
 {
-	int i;
+	char ch;
+
+	ch = c;
+	add_chars(tl, &ch, 1);
+}
 
-	if (tl->pos == tl->buf_len) {
-		tl->buf[tl->buf_len++] = c;
-		tl->buf[tl->buf_len] = 0;
-		tl->print(tl->user, tl->buf + tl->buf_len - 1);
-		tl->pos++;
+#if TL_CONFIG_COMPLETION
+/*
+ * Split and tokenize the line up to the word being completed, or all of
+ * it if that's empty. The tokenizer state at that point is kept, and
+ * picked up again by the next Tab as long as the line wasn't changed
+ * before it, so only words added since then need to be tokenized.
+ */
+static int complete_tokenize(t_tokenline *tl, int partial,
+		const t_token **complete_tokens, int *complete_arg)
+{
+	t_tokenize_state st;
+	int first, start, n;
+
+	/* Only the last command on the line is completed. */
+	start = last_command(tl, tl->buf, tl->buf_len);
+	if (tl->tok_cache_len && tl->tok_cache_len <= tl->buf_len
+			&& start <= tl->tok_cache_pos) {
+		st = tl->tok_cache;
+		tl->parsed->last_token_entry = tl->tok_cache_entry;
+		first = tl->tok_cache_words;
+		if (!split_line_from(tl, tl->buf, tl->buf_len, tl->tok_cache_pos,
+				tl->tok_cache_out, first, TRUE))
+			return FALSE;
 	} else {
-		memmove(tl->buf + tl->pos + 1, tl->buf + tl->pos,
-				tl->buf_len - tl->pos + 1);
-		tl->buf[tl->pos] = c;
-		tl->print(tl->user, tl->buf + tl->pos);
-		for (i = 0; i < tl->buf_len - tl->pos; i++)
-			tl->print(tl->user, "\x1b\x5b\x44");
-		tl->buf_len++;
-		tl->pos++;
+		tokenize_start(tl, &st);
+		first = 0;
+		if (!split_line_from(tl, tl->buf, tl->buf_len, start, 0, 0, TRUE))
+			return FALSE;
+	}
+	if (!tl->num_words)
+		return FALSE;
+
+	n = partial ? tl->num_words - 1 : tl->num_words;
+	if (!tokenize(tl, &st, tl->words, first, n, complete_tokens, complete_arg))
+		return FALSE;
+
+	if (n) {
+		tl->tok_cache = st;
+		tl->tok_cache_entry = tl->parsed->last_token_entry;
+		tl->tok_cache_words = n;
+		if (partial) {
+			/* Also depends on the first character of the next word. */
+			tl->tok_cache_pos = tl->word_pos;
+			tl->tok_cache_out = tl->words[n];
+			tl->tok_cache_len = tl->word_pos + 1;
+		} else {
+			tl->tok_cache_pos = tl->tok_cache_len = tl->buf_len;
+			tl->tok_cache_out = tl->split_len;
+		}
 	}
+
+	return TRUE;
 }
 
-static void set_line(t_tokenline *tl, char *line)
+/* Add the rest of the keyword the word is a prefix of. */
+static void complete_word(t_tokenline *tl, const char *word,
+		const char *keyword)
 {
-	int size;
+	int len;
 
-	size = strlen(line);
-	if (size > TL_MAX_LINE_LEN - 1) {
-		add_char(tl, '!');
-		return;
+	len = strlen(word);
+	add_chars(tl, keyword + len, strlen(keyword) - len);
+
+	if(tl->pos+1 < tl->line_size - 1)
+		add_char(tl, ' ');
+}
+
+/*
+ * The next entry of tokens from *t on with a keyword starting with the
+ * len characters of word, or NULL. With the table indexed, the matches
+ * are a run of its sorted entries from index_lower_bound(), and *t counts
+ * entries instead.
+ */
+static const t_token *next_match(t_tokenline *tl, const t_token *tokens,
+		const t_token_index_table *table, const char *word, int len, int *t)
+{
+	const t_token_index_entry *e;
+
+	if (table) {
+		if (*t == table->count)
+			return NULL;
+		e = &tl->index->entries[table->start + *t];
+		if (e->len < len || memcmp(tl->index->keywords + e->keyword, word, len))
+			return NULL;
+		(*t)++;
+		return &tokens[e->pos];
 	}
 
-	if (tl->pos == tl->buf_len) {
-		tl->print(tl->user, line);
-		tl->pos += size;
-		memcpy(tl->buf + tl->buf_len, line, size);
-		tl->buf_len += size;
-		tl->buf[tl->buf_len] = 0;
+	for (; tokens[*t].token; (*t)++) {
+		if (tokens[*t].token < T_ARG_UINT
+				&& !strncmp(word, tl->token_dict[tokens[*t].token].tokenstr, len))
+			return &tokens[(*t)++];
 	}
+
+	return NULL;
 }
 
-static void print_token_and_help(t_tokenline *tl, t_token *token)
+/*
+ * Complete the word as far as the keywords starting with it agree: the
+ * whole keyword if there's only one, or their longest common prefix,
+ * after which they're listed. Returns TRUE if the line needs to be shown
+ * again.
+ */
+static int complete_partial(t_tokenline *tl, const t_token *tokens,
+		const char *word)
 {
-	char *s;
+	const t_token_index_table *table;
+	const t_token *token;
+	const char *first, *keyword;
+	int len, lcp, width, count, start, t, i;
+
+	len = strlen(word);
+	table = tl->index ? index_find_table(tl->index, tokens) : NULL;
+	start = table ? index_lower_bound(tl->index, table, word) : 0;
+	first = NULL;
+	lcp = width = count = 0;
+	t = start;
+	while ((token = next_match(tl, tokens, table, word, len, &t))) {
+		keyword = tl->token_dict[token->token].tokenstr;
+		if (!count++) {
+			first = keyword;
+			lcp = strlen(keyword);
+		} else {
+			for (i = len; i < lcp && keyword[i] == first[i]; i++)
+				;
+			lcp = i;
+		}
+		i = strlen(keyword) + 2;
+		if (i > width)
+			width = i;
+	}
+	if (!count)
+		return FALSE;
+	if (count == 1) {
+		complete_word(tl, word, first);
+		return FALSE;
+	}
 
-	tl->print(tl->user, INDENT);
-	if (token->token < T_ARG_UINT)
-		s = tl->token_dict[token->token].tokenstr;
-	else
-		s = arg_type_to_string(token->token);
-	tl->print(tl->user, s);
-	if (token->help) {
-		tl->print(tl->user, space + strlen(s));
-		tl->print(tl->user, token->help);
+	/* Shown along with the rest of the line. */
+	line_insert(tl, first + len, lcp - len);
+	output(tl, NL);
+	if (width < HELP_COLUMN)
+		width = HELP_COLUMN;
+	t = start;
+	while ((token = next_match(tl, tokens, table, word, len, &t))) {
+		print_token_and_help(tl, token, width);
+		output(tl, NL);
 	}
+
+	return TRUE;
 }
 
 static void complete(t_tokenline *tl)
 {
-	t_token *tokens, *partial;
-	unsigned int i;
-	int words[TL_MAX_WORDS], num_words, arg_needed, multiple;
-	int reprompt, t;
-	char *word;
+	const t_token *tokens;
+	int arg_needed, reprompt;
 
 	reprompt = FALSE;
 	if (!tl->pos) {
 		/* Tab on an empty line: show all commmands. */
-		tl->print(tl->user, NL);
-		tokens = tl->token_levels[tl->token_level];
-		for (i = 0; tokens[i].token; i++) {
-			print_token_and_help(tl, &tokens[i]);
-			tl->print(tl->user, NL);
-		}
-		reprompt = TRUE;
+		output(tl, NL);
+		tl->job_resumable = TRUE;
+		list_start(tl, JOB_LIST, tl->token_levels[tl->token_level]);
+		tl->job_resumable = FALSE;
 	} else if (tl->buf[tl->pos - 1] != ' ') {
 		/* Try to complete the current word. */
-		if (!split_line(tl, words, &num_words, TRUE) || !num_words)
-			return;
-		if (tokenize(tl, words, num_words - 1, &tokens, NULL)) {
-			if (tokens) {
-				word = tl->buf + words[num_words - 1];
-				partial = NULL;
-				multiple = FALSE;
-				for (t = 0; tokens[t].token; t++) {
-					if (tokens[t].token >= T_ARG_UINT)
-						continue;
-					if (!strncmp(word, tl->token_dict[tokens[t].token].tokenstr, strlen(word))) {
-						if (partial) {
-							/* Not the first match, print previous one. */
-							multiple = TRUE;
-							tl->print(tl->user, NL);
-							print_token_and_help(tl, partial);
-						}
-						partial = &tokens[t];
-					}
-				}
-				if (partial) {
-					if (multiple) {
-						/* Last partial match. */
-						tl->print(tl->user, NL);
-						print_token_and_help(tl, partial);
-						tl->print(tl->user, NL);
-						reprompt = TRUE;
-					} else {
-						for (i = strlen(word); i < strlen(tl->token_dict[partial->token].tokenstr); i++)
-							add_char(tl, tl->token_dict[partial->token].tokenstr[i]);
-
-						if(tl->pos+1 < TL_MAX_LINE_LEN - 1)
-							add_char(tl, ' ');
-					}
-				}
-			}
-		}
+		if (complete_tokenize(tl, TRUE, &tokens, NULL) && tokens)
+			reprompt = complete_partial(tl, tokens,
+					tl->split_buf + tl->words[tl->num_words - 1]);
 	} else {
 		/* List all possible tokens from this point. */
-		if (!split_line(tl, words, &num_words, TRUE) || !num_words)
-			return;
-		if (tokenize(tl, words, num_words, &tokens, &arg_needed)) {
+		if (complete_tokenize(tl, FALSE, &tokens, &arg_needed)) {
 			if (arg_needed && arg_needed != T_ARG_TOKEN) {
-				tl->print(tl->user, INDENT NL);
-				tl->print(tl->user, arg_type_to_string(arg_needed));
-				tl->print(tl->user, NL);
+				output(tl, INDENT NL);
+				output(tl, arg_type_to_string(arg_needed));
+				output(tl, NL);
 				reprompt = TRUE;
+			} else if (tokens && tokens[0].token) {
+				output(tl, NL);
+				tl->job_resumable = TRUE;
+				list_start(tl, JOB_LIST, tokens);
+				tl->job_resumable = FALSE;
 			} else if (tokens) {
-				tl->print(tl->user, NL);
-				for (t = 0; tokens[t].token; t++) {
-					print_token_and_help(tl, &tokens[t]);
-					tl->print(tl->user, NL);
-					reprompt = TRUE;
-				}
+				output(tl, NL);
 			}
 		}
-	}
-	unsplit_line(tl);
-	if (reprompt) {
-		tl->print(tl->user, tl->prompt);
-		tl->print(tl->user, tl->buf);
+	}
+	if (reprompt) {
+		output(tl, tl->prompt);
+		output(tl, tl->buf);
+	}
+}
+#endif
+
+#if TL_CONFIG_HISTORY
+/*
+ * Replace the line with another one, only redrawing from the first
+ * character that differs. Leaves the cursor at the end.
+ */
+static void line_replace(t_tokenline *tl, const char *line)
+{
+	int size, same;
+
+	size = strlen(line);
+	if (size > tl->line_size - 1)
+		size = tl->line_size - 1;
+	for (same = 0; same < size && same < tl->buf_len; same++) {
+		if (tl->buf[same] != line[same])
+			break;
+	}
+
+	line_changed(tl, same);
+	cursor_move(tl, same - tl->pos);
+	output_len(tl, line + same, size - same);
+	if (size < tl->buf_len)
+		output(tl, ERASE_EOL);
+	memcpy(tl->buf + same, line + same, size - same);
+	tl->buf_len = size;
+	tl->buf[tl->buf_len] = 0;
+	tl->pos = size;
+}
+#endif
+
+/* Delete the n characters before the cursor. */
+static void line_delete_back(t_tokenline *tl, int n)
+{
+	line_changed(tl, tl->pos - n);
+	memmove(tl->buf + tl->pos - n, tl->buf + tl->pos,
+			tl->buf_len - tl->pos + 1);
+	tl->buf_len -= n;
+	tl->pos -= n;
+	cursor_move(tl, -n);
+	output(tl, tl->buf + tl->pos);
+	output(tl, ERASE_EOL);
+	cursor_move(tl, tl->pos - tl->buf_len);
+}
+
+static void line_home(t_tokenline *tl)
+{
+	cursor_move(tl, -tl->pos);
+	tl->pos = 0;
+}
+
+static void line_end(t_tokenline *tl)
+{
+	cursor_move(tl, tl->buf_len - tl->pos);
+	tl->pos = tl->buf_len;
+}
+
+static void line_delete_char(t_tokenline *tl)
+{
+	if (tl->pos < tl->buf_len) {
+		line_changed(tl, tl->pos);
+		memmove(tl->buf + tl->pos, tl->buf + tl->pos + 1,
+				tl->buf_len - tl->pos);
+		tl->buf_len--;
+		output(tl, tl->buf + tl->pos);
+		output(tl, ERASE_EOL);
+		cursor_move(tl, tl->pos - tl->buf_len);
+	}
+}
+
+/* Move the cursor to the start of the previous or next word. */
+static void line_word_left(t_tokenline *tl)
+{
+	int i;
+
+	i = tl->pos;
+	while (i && tl->buf[i - 1] == ' ')
+		i--;
+	while (i && tl->buf[i - 1] != ' ')
+		i--;
+	cursor_move(tl, i - tl->pos);
+	tl->pos = i;
+}
+
+static void line_word_right(t_tokenline *tl)
+{
+	int i;
+
+	i = tl->pos;
+	while (i < tl->buf_len && tl->buf[i] != ' ')
+		i++;
+	while (i < tl->buf_len && tl->buf[i] == ' ')
+		i++;
+	cursor_move(tl, i - tl->pos);
+	tl->pos = i;
+}
+
+static int escape_key(t_tokenline *tl, char intro, uint8_t c)
+{
+	unsigned int param, mod, i;
+
+	param = tl->escape_param[0] ? tl->escape_param[0] : 1;
+	mod = tl->escape_param[1] ? tl->escape_param[1] : 1;
+	for (i = 0; i < sizeof(escape_keys) / sizeof(escape_keys[0]); i++) {
+		if (escape_keys[i].intro == intro && escape_keys[i].final == c
+				&& escape_keys[i].param == param && escape_keys[i].mod == mod)
+			return escape_keys[i].key;
+	}
+
+	return KEY_NONE;
+}
+
+/*
+ * Feed a byte to the escape sequence decoder: ESC, then either CSI ('['),
+ * parameters and a final byte, SS3 ('O') and one byte, or any other
+ * character. Each byte moves the state along, and a finished sequence is
+ * looked up in escape_keys. Returns its key, KEY_NONE if it's not one of
+ * ours and is dropped, KEY_MORE while more bytes are needed, and
+ * KEY_ABORT if c is a control character that holds no sequence: any
+ * unfinished one is dropped, and c is left for normal input.
+ */
+static int escape_input(t_tokenline *tl, uint8_t c)
+{
+	int state, i;
+
+	if (c == 0x1b) {
+		/* Starts a sequence, dropping any unfinished one. */
+		tl->escape_state = ESC_ESC;
+		tl->escape_param[0] = 0;
+		tl->escape_param[1] = 0;
+		tl->escape_cur_param = 0;
+		return KEY_MORE;
+	}
+	state = tl->escape_state;
+	if (state == ESC_NONE || c < 0x20 || c > 0x7e) {
+		tl->escape_state = ESC_NONE;
+		return KEY_ABORT;
+	}
+
+	switch (state) {
+	case ESC_ESC:
+		if (c == '[') {
+			tl->escape_state = ESC_CSI;
+			return KEY_MORE;
+		} else if (c == 'O') {
+			tl->escape_state = ESC_SS3;
+			return KEY_MORE;
+		}
+		tl->escape_state = ESC_NONE;
+		return escape_key(tl, 0, c);
+	case ESC_SS3:
+		tl->escape_state = ESC_NONE;
+		return escape_key(tl, 'O', c);
+	default:
+		if (c >= 0x40) {
+			/* Final byte */
+			tl->escape_state = ESC_NONE;
+			return state == ESC_CSI ? escape_key(tl, '[', c) : KEY_NONE;
+		}
+		if (c >= '0' && c <= '9') {
+			/* Only the first two parameters matter. */
+			i = tl->escape_cur_param;
+			if (i < 2 && tl->escape_param[i] < 1000)
+				tl->escape_param[i] = tl->escape_param[i] * 10 + c - '0';
+		} else if (c == ';') {
+			if (tl->escape_cur_param < 2)
+				tl->escape_cur_param++;
+		} else {
+			/* Private parameter or intermediate bytes. */
+			tl->escape_state = ESC_CSI_IGNORE;
+		}
+		return KEY_MORE;
+	}
+}
+
+/*
+ * Pasted text is taken as is, and echoed once it's all in: see
+ * tl_set_paste(), which the bracketed paste markers also call.
+ */
+static void paste_start(t_tokenline *tl)
+{
+	tl->paste = TRUE;
+	echo_defer(tl);
+}
+
+static void paste_end(t_tokenline *tl)
+{
+	tl->paste = FALSE;
+	echo_end(tl);
+}
+
+/*
+ * While pasting, printable characters go into the line, tabs as spaces,
+ * and line ends run it. Anything else is dropped, except for the
+ * bracketed paste end marker.
+ */
+static void paste_input(t_tokenline *tl, uint8_t c)
+{
+	char ch;
+	int key;
+
+	key = escape_input(tl, c);
+	if (key == KEY_PASTE_END)
+		paste_end(tl);
+	if (key != KEY_ABORT)
+		return;
+
+	if (c == '\r' || c == '\n') {
+		process_line(tl);
+	} else if (c == '\t' || (c >= 0x20 && c <= 0x7e)) {
+		ch = c == '\t' ? ' ' : c;
+		add_chars(tl, &ch, 1);
+#if TL_CONFIG_HISTORY
+		tl->hist_step = -1;
+#endif
+	}
+}
+
+static void process_key(t_tokenline *tl, int key)
+{
+	switch (key) {
+#if TL_CONFIG_HISTORY
+	case KEY_UP:
+		history_up(tl);
+		break;
+	case KEY_DOWN:
+		history_down(tl);
+		break;
+#endif
+	case KEY_LEFT:
+		if (tl->pos > 0) {
+			tl->pos--;
+			cursor_move(tl, -1);
+		}
+		break;
+	case KEY_RIGHT:
+		if (tl->pos < tl->buf_len) {
+			tl->pos++;
+			cursor_move(tl, 1);
+		}
+		break;
+	case KEY_WORD_LEFT:
+		line_word_left(tl);
+		break;
+	case KEY_WORD_RIGHT:
+		line_word_right(tl);
+		break;
+	case KEY_HOME:
+		line_home(tl);
+		break;
+	case KEY_END:
+		line_end(tl);
+		break;
+	case KEY_DELETE:
+		line_delete_char(tl);
+		break;
+	case KEY_PASTE_START:
+		paste_start(tl);
+		break;
+	}
+}
+
+/* Offset of the keyword in the index, stored there if it isn't yet. */
+static int index_add_keyword(t_token_index *index, int token)
+{
+	const char *s;
+	int len, i;
+
+	for (i = 0; i < index->num_entries; i++) {
+		if (index->entries[i].token == token)
+			return index->entries[i].keyword;
+	}
+
+	s = index->token_dict[token].tokenstr;
+	len = strlen(s);
+	if (index->keywords_len + len + 1 > index->buffers->max_keywords)
+		return -1;
+	memcpy(index->buffers->keywords + index->keywords_len, s, len + 1);
+	index->keywords_len += len + 1;
+
+	return index->keywords_len - len - 1;
+}
+
+static int index_add_table(t_token_index *index, const t_token *tokens)
+{
+	t_token_index_table *table;
+	t_token_index_entry *entries, e;
+	int keywords_len, count, i, j;
+	const char *s;
+
+	if (index_find_table(index, tokens))
+		return TRUE;
+
+	count = 0;
+	for (i = 0; tokens[i].token; i++) {
+		if (tokens[i].token < T_ARG_UINT)
+			count++;
+	}
+	if (index->num_tables == index->buffers->max_tables
+			|| index->num_entries + count > index->buffers->max_entries)
+		return FALSE;
+
+	table = &index->buffers->tables[index->num_tables];
+	table->tokens = tokens;
+	table->start = index->num_entries;
+	table->count = count;
+	table->arg_uint = -1;
+	table->arg_string = -1;
+	entries = index->buffers->entries + table->start;
+	keywords_len = index->keywords_len;
+
+	/* Insertion sort by keyword, keeping table order for equal ones. */
+	count = 0;
+	for (i = 0; tokens[i].token; i++) {
+		if (tokens[i].token == T_ARG_UINT && table->arg_uint == -1)
+			table->arg_uint = i;
+		else if (tokens[i].token == T_ARG_STRING && table->arg_string == -1)
+			table->arg_string = i;
+		if (tokens[i].token >= T_ARG_UINT)
+			continue;
+		e.token = tokens[i].token;
+		e.pos = i;
+		if ((j = index_add_keyword(index, e.token)) == -1) {
+			/* Out of keyword space: leave the whole table out. */
+			index->keywords_len = keywords_len;
+			index->num_entries = table->start;
+			return FALSE;
+		}
+		e.keyword = j;
+		s = index->keywords + e.keyword;
+		e.len = strlen(s);
+		for (j = count; j > 0; j--) {
+			if (strcmp(index->keywords + entries[j - 1].keyword, s) <= 0)
+				break;
+			entries[j] = entries[j - 1];
+		}
+		entries[j] = e;
+		count++;
+		/* Lets index_add_keyword() find the keywords added so far. */
+		index->num_entries = table->start + count;
+	}
+	index->num_tables++;
+
+	return TRUE;
+}
+
+#if TL_CONFIG_SPECIAL_CHARS
+/* The keywords split_line_from() must not break apart, sorted. */
+static void index_add_special(t_token_index *index,
+		const t_token_dict *token_dict)
+{
+	uint16_t *special, e;
+	int x, i, j;
+	const char *s;
+
+	special = index->buffers->special;
+	for (x = 1; token_dict[x].token; x++) {
+		s = token_dict[x].tokenstr;
+		for (i = 1; s[i]; i++) {
+			if (CHAR_CLASS(s[i]) & (CC_SPECIAL | CC_QUOTE))
+				break;
+		}
+		if (!s[i])
+			continue;
+		if (index->num_special == index->buffers->max_special) {
+			index->num_special = -1;
+			break;
+		}
+		for (j = index->num_special; j > 0; j--) {
+			e = special[j - 1];
+			if (strcmp(token_dict[e].tokenstr, s) <= 0)
+				break;
+			special[j] = e;
+		}
+		special[j] = x;
+		index->num_special++;
 	}
 }
+#endif
 
-static void line_clear(t_tokenline *tl)
+/*
+ * Start an index defined with TL_DEFINE_INDEX over, for the tables of
+ * token_dict. Without buffers it stays empty, and has the dictionary
+ * searched for special keywords.
+ */
+void tl_index_init(t_token_index *index, const t_token_dict *token_dict)
 {
-	while (tl->pos < tl->buf_len) {
-		tl->pos++;
-		tl->print(tl->user, "\x1b\x5b\x43");
+	const t_token_index_buffers *buffers;
+
+	buffers = index->buffers;
+	memset(index, 0, sizeof(t_token_index));
+	index->token_dict = token_dict;
+	if (!(index->buffers = buffers)) {
+		index->num_special = -1;
+		return;
 	}
-	while (tl->pos)
-		line_backspace(tl);
+	index->tables = buffers->tables;
+	index->entries = buffers->entries;
+	index->keywords = buffers->keywords;
+	index->special = buffers->special;
+#if TL_CONFIG_SPECIAL_CHARS
+	index_add_special(index, token_dict);
+#endif
 }
 
-static void line_backspace(t_tokenline *tl)
+/*
+ * Index the token table and every table reachable from it. Tables that
+ * don't fit are left out, and are searched linearly as before.
+ */
+int tl_index_add(t_token_index *index, const t_token *tokens)
 {
-	int i;
+	const t_token *table;
+	int ret, t, i;
 
-	if (tl->pos == tl->buf_len) {
-		tl->buf[tl->buf_len - 1] = 0;
-		tl->print(tl->user, "\x1b\x5b\x44 \x1b\x5b\x44");
-	} else {
-		memmove(tl->buf + tl->pos - 1, tl->buf + tl->pos,
-				tl->buf_len - tl->pos + 1);
-		tl->print(tl->user, "\x1b\x5b\x44");
-		tl->print(tl->user, tl->buf + tl->pos - 1);
-		tl->print(tl->user, " ");
-		for (i = 0; i < tl->buf_len - tl->pos + 1; i++)
-			tl->print(tl->user, "\x1b\x5b\x44");
+	t = index->num_tables;
+	if (!index->buffers || !index_add_table(index, tokens))
+		return FALSE;
+
+	ret = TRUE;
+	for (; t < index->num_tables; t++) {
+		table = index->tables[t].tokens;
+		for (i = 0; table[i].token; i++) {
+			if (table[i].subtokens && !index_add_table(index, table[i].subtokens))
+				ret = FALSE;
+		}
 	}
-	tl->buf_len--;
-	tl->pos--;
+
+	return ret;
 }
 
-static void line_home(t_tokenline *tl)
+/*
+ * Set up an instance using the given buffers. Sizes over the maximums in
+ * tokenline.h are clipped.
+ */
+void tl_init_buffers(t_tokenline *tl, const t_token *tokens_top,
+		const t_token_dict *token_dict, tl_printfunc printfunc, void *user,
+		const t_tokenline_buffers *buffers)
 {
-	while (tl->pos) {
-		tl->pos--;
-		tl->print(tl->user, "\x1b\x5b\x44");
-	}
+	memset(tl, 0, sizeof(t_tokenline));
+	tl->buf = buffers->line;
+	tl->line_size = buffers->line_size;
+	if (tl->line_size > TL_MAX_LINE_LEN)
+		tl->line_size = TL_MAX_LINE_LEN;
+	tl->buf[0] = 0;
+	tl->split_buf = buffers->split;
+	tl->words = buffers->words;
+	tl->max_words = buffers->max_words;
+	if (tl->max_words > TL_MAX_WORDS)
+		tl->max_words = TL_MAX_WORDS;
+	tl->parsed = buffers->parsed;
+	tl->parsed->num_tokens = 0;
+	tl->parsed->buf_len = 0;
+#if TL_CONFIG_ARG_VIEWS
+	tl->parsed->num_args = 0;
+#endif
+	tl->parsed->last_token_entry = NULL;
+	tl->parsed->handler = NULL;
+#if TL_CONFIG_HISTORY
+	tl->hist_buf = buffers->hist_buf;
+	tl->hist_size = buffers->hist_size;
+	/* Entry offsets are 16-bit. */
+	if (tl->hist_size > 0xffff)
+		tl->hist_size = 0xffff;
+	tl->hist_index = buffers->hist_index;
+	tl->hist_entries = buffers->hist_entries;
+	if (!tl->hist_entries)
+		tl->hist_size = 0;
+	tl->hist_step = -1;
+#endif
+	tl->token_levels[0] = tokens_top;
+	tl->token_dict = token_dict;
+	tl->print = printfunc;
+	tl->user = user;
+	tl->one_command_per_line = TL_ONE_COMMAND_PER_LINE;
+#if TL_CONFIG_ARG_VIEWS
+	tl->arg_views = TL_ARG_VIEWS;
+#endif
+	tl->separator = TL_COMMAND_SEPARATOR;
+	tl->echo_pos = -1;
+#if TL_MAX_ALIASES
+	tl->alias_gen = 1;
+#endif
 }
 
-static void line_end(t_tokenline *tl)
+#if TL_EMBEDDED_BUFFERS
+void tl_init(t_tokenline *tl, const t_token *tokens_top,
+		const t_token_dict *token_dict, tl_printfunc printfunc, void *user)
+{
+	t_tokenline_buffers buffers;
+	t_tokenline_parsed *p;
+
+	buffers.line = tl->storage.line;
+	buffers.line_size = TL_MAX_LINE_LEN;
+	buffers.split = tl->storage.split;
+	buffers.words = tl->storage.words;
+	buffers.max_words = TL_MAX_WORDS;
+	buffers.parsed = &tl->storage.parsed;
+#if TL_CONFIG_HISTORY
+	buffers.hist_buf = tl->storage.hist_buf;
+	buffers.hist_size = TL_MAX_HISTORY_SIZE;
+	buffers.hist_index = tl->storage.hist_index;
+	buffers.hist_entries = TL_MAX_HISTORY_ENTRIES;
+#endif
+	tl_init_buffers(tl, tokens_top, token_dict, printfunc, user, &buffers);
+	/* tl_init_buffers() cleared tl, storage and all. */
+	p = &tl->storage.parsed;
+	p->tokens = tl->storage.parsed_tokens;
+	p->max_tokens = TL_MAX_WORDS;
+	p->buf = tl->storage.parsed_buf;
+	p->buf_size = TL_MAX_LINE_LEN;
+#if TL_CONFIG_ARG_VIEWS
+	p->args = tl->storage.parsed_args;
+	p->max_args = TL_MAX_ARGS;
+#endif
+}
+#endif
+
+void tl_set_prompt(t_tokenline *tl, const char *prompt)
 {
-	while (tl->pos < tl->buf_len) {
-		tl->pos++;
-		tl->print(tl->user, "\x1b\x5b\x43");
+	if (!tl->prompt) {
+		output(tl, prompt);
+		tl_flush(tl);
 	}
+	tl->prompt = prompt;
 }
 
-static void line_delete_char(t_tokenline *tl)
+void tl_set_writefunc(t_tokenline *tl, tl_writefunc writefunc)
 {
-	int i;
+	tl_flush(tl);
+	tl->write = writefunc;
+}
 
-	if (tl->pos < tl->buf_len) {
-		memmove(tl->buf + tl->pos, tl->buf + tl->pos + 1,
-				tl->buf_len - tl->pos);
-		tl->print(tl->user, tl->buf + tl->pos);
-		tl->print(tl->user, " ");
-		for (i = 0; i < tl->buf_len - tl->pos; i++)
-			tl->print(tl->user, "\x1b\x5b\x44");
-		tl->buf_len--;
-	}
+void tl_set_callback(t_tokenline *tl, tl_callback callback)
+{
+	tl->callback = callback;
 }
 
-static int process_escape(t_tokenline *tl)
+/*
+ * Copy the command being dispatched into p, for use from a handler or
+ * callback. Arguments are copied into its buf, also with arg_views set,
+ * so the copy stays valid after the line is gone. Returns FALSE if p
+ * doesn't have the room.
+ */
+int tl_capture(t_tokenline *tl, t_tokenline_parsed *p)
 {
-	if (tl->escape_len == 4) {
-		if (!strncmp(tl->escape, "\x1b\x5b\x33\x7e", 4)) {
-			/* Delete */
-			line_delete_char(tl);
-		} else if (!strncmp(tl->escape, "\x1b\x5b\x31\x7e", 4)) {
-			/* Home */
-			line_home(tl);
-		} else if (!strncmp(tl->escape, "\x1b\x5b\x34\x7e", 4)) {
-			/* End */
-			line_end(tl);
-		}
-	} else if (tl->escape_len == 3) {
-		if (!strncmp(tl->escape, "\x1b\x5b\x41", 3)) {
-			/* Up arrow */
-			history_up(tl);
-		} else if (!strncmp(tl->escape, "\x1b\x5b\x42", 3)) {
-			/* Down arrow */
-			history_down(tl);
-		} else if (!strncmp(tl->escape, "\x1b\x5b\x44", 3)) {
-			/* Left arrow */
-			if (tl->pos > 0) {
-				tl->pos--;
-				tl->print(tl->user, "\x1b\x5b\x31\x44");
-			}
-		} else if (!strncmp(tl->escape, "\x1b\x5b\x43", 3)) {
-			/* Right arrow */
-			if (tl->pos < tl->buf_len) {
-				tl->pos++;
-				tl->print(tl->user, "\x1b\x5b\x31\x43");
-			}
-		} else if (!strncmp(tl->escape, "\x1b\x4f\x48", 3)) {
-			/* Home */
-			line_home(tl);
-		} else if (!strncmp(tl->escape, "\x1b\x4f\x46", 3)) {
-			/* End */
-			line_end(tl);
-		} else
+	t_tokenline_parsed *src;
+#if TL_CONFIG_ARG_VIEWS
+	t_tokenline_arg *arg;
+	int offset, i;
+#endif
+
+	src = tl->parsed;
+	if (src->num_tokens > p->max_tokens)
+		return FALSE;
+	memcpy(p->tokens, src->tokens, src->num_tokens * sizeof(int));
+	p->num_tokens = src->num_tokens;
+	p->last_token_entry = src->last_token_entry;
+	p->handler = src->handler;
+#if TL_CONFIG_ARG_VIEWS
+	if (tl->arg_views) {
+		if (src->num_args > p->max_args)
 			return FALSE;
-	} else
+		memcpy(p->args, src->args, src->num_args * sizeof(t_tokenline_arg));
+		p->num_args = src->num_args;
+		/* Move string views out of split_buf. */
+		offset = 0;
+		i = 0;
+		while ((arg = next_string(p, &i))) {
+			if (offset + arg->len + 1 > p->buf_size)
+				return FALSE;
+			memcpy(p->buf + offset, arg->u.arg_string, arg->len + 1);
+			arg->u.arg_string = p->buf + offset;
+			offset += arg->len + 1;
+		}
+		p->buf_len = offset;
+		return TRUE;
+	}
+#endif
+	if (src->buf_len > p->buf_size)
 		return FALSE;
+	memcpy(p->buf, src->buf, src->buf_len);
+	p->buf_len = src->buf_len;
 
 	return TRUE;
 }
 
-void tl_init(t_tokenline *tl, t_token *tokens_top, t_token_dict *token_dict,
-		tl_printfunc printfunc, void *user)
+/* Dispatch a captured command again, without tokenizing anything. */
+void tl_replay(t_tokenline *tl, t_tokenline_parsed *p)
 {
-	memset(tl, 0, sizeof(t_tokenline));
-	tl->token_levels[0] = tokens_top;
-	tl->token_dict = token_dict;
-	tl->print = printfunc;
-	tl->user = user;
-	tl->one_command_per_line = TL_ONE_COMMAND_PER_LINE;
-	tl->hist_step = -1;
+	dispatch(tl, p);
 }
 
-void tl_set_prompt(t_tokenline *tl, char *prompt)
+#ifdef TL_PROFILE
+/*
+ * Set the cycle counter used to time phases, e.g. one returning
+ * DWT->CYCCNT. Without one only the counts are kept.
+ */
+void tl_set_cyclefunc(t_tokenline *tl, tl_cyclefunc cyclefunc)
 {
-	if (!tl->prompt)
-		tl->print(tl->user, prompt);
-	tl->prompt = prompt;
+	tl->cycles = cyclefunc;
 }
 
-void tl_set_callback(t_tokenline *tl, tl_callback callback)
+void tl_stats_get(t_tokenline *tl, t_tokenline_stats *stats)
 {
-	tl->callback = callback;
+	memcpy(stats, &tl->stats, sizeof(t_tokenline_stats));
+}
+
+void tl_stats_reset(t_tokenline *tl)
+{
+	memset(&tl->stats, 0, sizeof(t_tokenline_stats));
+}
+#endif
+
+void tl_set_index(t_tokenline *tl, const t_token_index *index)
+{
+	tl->index = index;
+	line_changed(tl, 0);
+#if TL_MAX_ALIASES
+	tl_tables_changed(tl);
+#endif
 }
 
-int tl_mode_push(t_tokenline *tl, t_token *tokens)
+#if TL_MAX_ALIASES
+/*
+ * Call after changing the token tables or dictionary, so aliases no longer
+ * run from what their commands tokenized to before.
+ */
+void tl_tables_changed(t_tokenline *tl)
+{
+	/* A cache_gen of 0 is never valid. */
+	if (!++tl->alias_gen)
+		tl->alias_gen = 1;
+}
+#endif
+
+int tl_mode_push(t_tokenline *tl, const t_token *tokens)
 {
 	if (tl->token_level == TL_MAX_TOKEN_LEVELS - 1)
 		return FALSE;
 
 	tl->token_levels[++tl->token_level] = tokens;
+	line_changed(tl, 0);
 
 	return TRUE;
 }
@@ -1093,53 +3248,234 @@ int tl_mode_pop(t_tokenline *tl)
 		return FALSE;
 
 	tl->token_level--;
+	line_changed(tl, 0);
 
 	return TRUE;
 }
 
-int tl_input(t_tokenline *tl, uint8_t c)
+#if TL_CONFIG_HISTORY
+/*
+ * A history image is this header, then hist_index and hist_buf as they
+ * are, so importing one is a memcpy of each once it checks out. It's only
+ * good for builds with the same layout, and instances with the same
+ * history buffer sizes.
+ */
+#define HISTORY_IMAGE_MAGIC   0x484c5400
+#define HISTORY_IMAGE_VERSION 1
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t hist_entries;
+	uint32_t hist_size;
+	uint16_t hist_first;
+	uint16_t hist_count;
+	/* FNV-1a of the image, with this set to 0. */
+	uint32_t check;
+} t_history_image;
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *p;
+
+	for (p = data; len--; p++)
+		hash = (hash ^ *p) * 16777619;
+
+	return hash;
+}
+
+static uint32_t history_image_check(t_tokenline *tl, t_history_image *hdr,
+		const void *index, const void *buf)
+{
+	uint32_t check, hash;
+
+	check = hdr->check;
+	hdr->check = 0;
+	hash = fnv1a(2166136261U, hdr, sizeof(t_history_image));
+	hash = fnv1a(hash, index, tl->hist_entries * sizeof(t_history_entry));
+	hash = fnv1a(hash, buf, tl->hist_size);
+	hdr->check = check;
+
+	return hash;
+}
+
+/* Size of the image tl_history_export() writes. */
+size_t tl_history_image_size(t_tokenline *tl)
+{
+	return sizeof(t_history_image)
+		+ tl->hist_entries * sizeof(t_history_entry) + tl->hist_size;
+}
+
+/*
+ * Write the history to image, e.g. to keep it in a flash page across
+ * resets. Returns the size of the image, or 0 if size is too small.
+ */
+size_t tl_history_export(t_tokenline *tl, void *image, size_t size)
+{
+	t_history_image hdr;
+	uint8_t *p;
+
+	if (size < tl_history_image_size(tl))
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = HISTORY_IMAGE_MAGIC;
+	hdr.version = HISTORY_IMAGE_VERSION;
+	hdr.hist_entries = tl->hist_entries;
+	hdr.hist_size = tl->hist_size;
+	hdr.hist_first = tl->hist_first;
+	hdr.hist_count = tl->hist_count;
+	hdr.check = history_image_check(tl, &hdr, tl->hist_index, tl->hist_buf);
+	p = image;
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+	memcpy(p, tl->hist_index, tl->hist_entries * sizeof(t_history_entry));
+	p += tl->hist_entries * sizeof(t_history_entry);
+	memcpy(p, tl->hist_buf, tl->hist_size);
+
+	return tl_history_image_size(tl);
+}
+
+/*
+ * Replace the history with the one in an image written by
+ * tl_history_export(). Returns FALSE, leaving the history alone, if the
+ * image is damaged, or from another build or history size.
+ */
+int tl_history_import(t_tokenline *tl, const void *image, size_t size)
+{
+	t_history_entry entry;
+	t_history_image hdr;
+	const uint8_t *index, *buf;
+	int i, n;
+
+	if (!tl->hist_size || size < tl_history_image_size(tl))
+		return FALSE;
+	memcpy(&hdr, image, sizeof(hdr));
+	index = (const uint8_t *)image + sizeof(hdr);
+	buf = index + tl->hist_entries * sizeof(t_history_entry);
+	if (hdr.magic != HISTORY_IMAGE_MAGIC
+			|| hdr.version != HISTORY_IMAGE_VERSION
+			|| hdr.hist_entries != tl->hist_entries
+			|| hdr.hist_size != (uint32_t)tl->hist_size
+			|| hdr.hist_first >= tl->hist_entries
+			|| hdr.hist_count > tl->hist_entries
+			|| hdr.check != history_image_check(tl, &hdr, index, buf))
+		return FALSE;
+	/*
+	 * Entries must be terminated strings inside hist_buf, that fit the
+	 * line they're recalled into.
+	 */
+	for (i = 0; i < hdr.hist_count; i++) {
+		n = (hdr.hist_first + i) % tl->hist_entries;
+		memcpy(&entry, index + n * sizeof(t_history_entry), sizeof(entry));
+		if (entry.offset + entry.len >= tl->hist_size
+				|| entry.len >= tl->line_size
+				|| buf[entry.offset + entry.len])
+			return FALSE;
+	}
+
+	memcpy(tl->hist_index, index, tl->hist_entries * sizeof(t_history_entry));
+	memcpy(tl->hist_buf, buf, tl->hist_size);
+	tl->hist_first = hdr.hist_first;
+	tl->hist_count = hdr.hist_count;
+	tl->hist_step = -1;
+
+	return TRUE;
+}
+#endif
+
+/* Add characters to the line in batch mode, where nothing is echoed. */
+static void batch_add(t_tokenline *tl, const char *chars, int len)
+{
+	if (len > tl->line_size - 1 - tl->buf_len) {
+		len = tl->line_size - 1 - tl->buf_len;
+		tl->batch_overflow = TRUE;
+	}
+	memcpy(tl->buf + tl->buf_len, chars, len);
+	tl->buf_len += len;
+	tl->buf[tl->buf_len] = 0;
+	tl->pos = tl->buf_len;
+}
+
+/* Batch mode only collects lines: no line editing or escape sequences. */
+static int batch_input(t_tokenline *tl, uint8_t c)
+{
+	char ch;
+
+	switch (c) {
+	case '\r':
+	case '\n':
+		process_line(tl);
+		break;
+	case 0x04:
+		/* Ctrl-d on empty line exits. */
+		if (!tl->buf_len)
+			return FALSE;
+		break;
+	default:
+		if (c >= 0x20 && c <= 0x7e) {
+			ch = c;
+			batch_add(tl, &ch, 1);
+		}
+		break;
+	}
+
+	return TRUE;
+}
+
+static int input_char(t_tokenline *tl, uint8_t c)
 {
-	int ret, i;
+	int ret, key, i;
+
+	if (tl->batch)
+		return batch_input(tl, c);
 
-	if (tl->escape_len) {
-		tl->escape[tl->escape_len++] = c;
-		if (process_escape(tl))
-			tl->escape_len = 0;
-		else if (tl->escape_len == TL_MAX_ESCAPE_LEN)
-			/* Not a valid escape sequence, and buffer full. */
-			tl->escape_len = 0;
+	if (tl->paste) {
+		paste_input(tl, c);
 		return TRUE;
 	}
 
+	if (tl->escape_state) {
+		key = escape_input(tl, c);
+		if (key != KEY_ABORT) {
+			process_key(tl, key);
+			return TRUE;
+		}
+	}
+
+#if TL_CONFIG_HISTORY
+	if (tl->searching && search_input(tl, c))
+		return TRUE;
+#endif
+
 	ret = TRUE;
 	switch (c) {
 	case 0x1b:
 		/* Start of escape sequence. */
-		tl->escape[tl->escape_len++] = c;
+		escape_input(tl, c);
 		break;
 	case '\r':
 	case '\n':
 		process_line(tl);
 		break;
+#if TL_CONFIG_COMPLETION
 	case '\t':
 		if (tl->buf_len == tl->pos)
 			complete(tl);
 		break;
+#endif
 	case 0x7f:
 		/* Backspace */
 		if (tl->pos)
-			line_backspace(tl);
+			line_delete_back(tl, 1);
 		break;
 	case 0x01:
 		/* Ctrl-a */
-		while (tl->pos) {
-			tl->pos--;
-			tl->print(tl->user, "\x1b\x5b\x44");
-		}
+		line_home(tl);
 		break;
 	case 0x03:
 		/* Ctrl-c */
-		tl->print(tl->user, "^C");
+		output(tl, "^C");
 		tl->buf_len = 0;
 		process_line(tl);
 		break;
@@ -1153,28 +3489,24 @@ int tl_input(t_tokenline *tl, uint8_t c)
 		break;
 	case 0x05:
 		/* Ctrl-e */
-		while (tl->pos < tl->buf_len) {
-			tl->pos++;
-			tl->print(tl->user, "\x1b\x5b\x43");
-		}
+		line_end(tl);
 		break;
 	case 0x0b:
 		/* Ctrl-k */
 		if (tl->buf_len > tl->pos) {
-			for (i = 0; i < tl->buf_len - tl->pos; i++)
-				tl->print(tl->user, " ");
-			for (i = 0; i < tl->buf_len - tl->pos; i++)
-				tl->print(tl->user, "\x1b\x5b\x44");
+			line_changed(tl, tl->pos);
+			output(tl, ERASE_EOL);
 			tl->buf_len = tl->pos;
 			tl->buf[tl->buf_len] = 0;
 		}
 		break;
 	case 0x0c:
 		/* Ctrl-l */
-		tl->print(tl->user, "\x1b\x5b\x32\x4a\x1b\x5b\x48");
-		tl->print(tl->user, tl->prompt);
-		tl->print(tl->user, tl->buf);
+		output(tl, "\x1b\x5b\x32\x4a\x1b\x5b\x48");
+		output(tl, tl->prompt);
+		output(tl, tl->buf);
 		break;
+#if TL_CONFIG_HISTORY
 	case 0x10:
 		/* Ctrl-p */
 		history_up(tl);
@@ -1183,18 +3515,28 @@ int tl_input(t_tokenline *tl, uint8_t c)
 		/* Ctrl-n */
 		history_down(tl);
 		break;
+	case 0x12:
+		/* Ctrl-r */
+		search_start(tl);
+		break;
+#endif
 	case 0x17:
 		/* Ctrl-w */
-		while (tl->pos && tl->buf[tl->pos - 1] == ' ')
-			line_backspace(tl);
-		while (tl->pos && tl->buf[tl->pos - 1] != ' ')
-			line_backspace(tl);
+		i = tl->pos;
+		while (i && tl->buf[i - 1] == ' ')
+			i--;
+		while (i && tl->buf[i - 1] != ' ')
+			i--;
+		if (i < tl->pos)
+			line_delete_back(tl, tl->pos - i);
 		break;
 	default:
 		if (c >= 0x20 && c <= 0x7e) {
-			if (tl->buf_len < TL_MAX_LINE_LEN - 1)
+			if (tl->buf_len < tl->line_size - 1)
 				add_char(tl, c);
+#if TL_CONFIG_HISTORY
 			tl->hist_step = -1;
+#endif
 		}
 		break;
 	}
@@ -1202,3 +3544,278 @@ int tl_input(t_tokenline *tl, uint8_t c)
 	return ret;
 }
 
+/*
+ * Returns FALSE if the user exited, or TL_BUSY if the character wasn't
+ * taken because a command is still waiting for room in the transmit ring:
+ * feed it again later.
+ */
+int tl_input(t_tokenline *tl, uint8_t c)
+{
+	int ret;
+
+	if (job_resume(tl))
+		ret = input_char(tl, c);
+	else
+		ret = TL_BUSY;
+	tl_flush(tl);
+
+	return ret;
+}
+
+/*
+ * Handled as a burst: runs of printable characters are added to the line,
+ * and lines run, with the echo deferred until something else comes up or
+ * the end of buf, see echo_defer(). Everything else is handled as in
+ * tl_input(). Stops early when a command is suspended, see job_room(), or
+ * with hold whenever tl_tx_busy(), and returns how much of buf was used.
+ */
+static size_t input_buf(t_tokenline *tl, const uint8_t *buf, size_t len,
+		int hold, int *ret)
+{
+	size_t i, run;
+
+	*ret = TRUE;
+	i = 0;
+	while (i < len && !(hold ? tl_tx_busy(tl) : tl->job.type)) {
+		if (!tl->escape_state
+#if TL_CONFIG_HISTORY
+				&& !tl->searching
+#endif
+				&& buf[i] >= 0x20 && buf[i] <= 0x7e) {
+			run = 1;
+			while (i + run < len && buf[i + run] >= 0x20 && buf[i + run] <= 0x7e)
+				run++;
+			if (tl->batch) {
+				batch_add(tl, (const char *)buf + i, run);
+			} else {
+				echo_defer(tl);
+				add_chars(tl, (const char *)buf + i, run);
+#if TL_CONFIG_HISTORY
+				tl->hist_step = -1;
+#endif
+			}
+			i += run;
+		} else {
+			if (!tl->paste && buf[i] != '\r' && buf[i] != '\n')
+				echo_end(tl);
+			if (!input_char(tl, buf[i++])) {
+				*ret = FALSE;
+				break;
+			}
+		}
+	}
+	if (!tl->paste)
+		echo_end(tl);
+
+	return i;
+}
+
+/*
+ * Feed a block of input. Returns FALSE if the user exited, or TL_BUSY if
+ * a command is waiting for room in the transmit ring, and not all of buf
+ * was taken: unless used is NULL, it's set to how much was, and the rest
+ * is to be fed again once tl_tx_busy() clears. tl_poll() does this by
+ * itself.
+ */
+int tl_input_buf(t_tokenline *tl, const uint8_t *buf, size_t len,
+		size_t *used)
+{
+	size_t n;
+	int ret;
+
+	ret = TRUE;
+	n = 0;
+	if (!job_resume(tl))
+		ret = TL_BUSY;
+	else if ((n = input_buf(tl, buf, len, FALSE, &ret)) < len && ret)
+		ret = TL_BUSY;
+	if (used)
+		*used = n;
+	tl_flush(tl);
+
+	return ret;
+}
+
+#if TL_RX_RING_SIZE
+/*
+ * Queue a byte for tl_poll(). This does no other work, and is safe to call
+ * from an interrupt handler while tl_poll() runs, as long as there's only
+ * one caller at a time. Returns FALSE if the ring was full, and the byte
+ * was dropped.
+ */
+int tl_rx_push(t_tokenline *tl, uint8_t c)
+{
+	uint32_t head;
+
+	head = tl->rx.head;
+	if (head - tl->rx.tail == TL_RX_RING_SIZE) {
+		tl->rx.dropped++;
+		return FALSE;
+	}
+	tl->rx.buf[head & (TL_RX_RING_SIZE - 1)] = c;
+	TL_RING_BARRIER();
+	tl->rx.head = head + 1;
+
+	return TRUE;
+}
+
+/*
+ * Feed the bytes queued by tl_rx_push() as tl_input_buf() would, in at
+ * most two runs per call. Returns FALSE if the user exited, or TL_BUSY if
+ * some were left in the ring until tl_tx_busy() clears.
+ */
+int tl_poll(t_tokenline *tl)
+{
+	uint32_t head, tail, pos, len;
+	int ret;
+
+	ret = TRUE;
+	tl_flush(tl);
+	job_resume(tl);
+	head = tl->rx.head;
+	TL_RING_BARRIER();
+	tail = tl->rx.tail;
+	while (ret && tail != head && !tl_tx_busy(tl)) {
+		pos = tail & (TL_RX_RING_SIZE - 1);
+		len = head - tail;
+		if (len > TL_RX_RING_SIZE - pos)
+			len = TL_RX_RING_SIZE - pos;
+		tail += input_buf(tl, tl->rx.buf + pos, len, TRUE, &ret);
+		tl_flush(tl);
+		TL_RING_BARRIER();
+		tl->rx.tail = tail;
+	}
+	if (ret && tl->rx.tail != head)
+		ret = TL_BUSY;
+	tl_flush(tl);
+
+	return ret;
+}
+#endif
+
+/*
+ * Whether input should be held back: a command is waiting for room in the
+ * transmit ring, or less than half of it is free. Output is only
+ * suspended between the items of the help and history listings; anything
+ * that still doesn't fit is dropped.
+ */
+int tl_tx_busy(t_tokenline *tl)
+{
+	if (tl->job.type)
+		return TRUE;
+#if TL_TX_RING_SIZE
+	if (tl->tx_ring && (tl->out_len || tx_room(tl) < TL_TX_RING_SIZE / 2))
+		return TRUE;
+#endif
+
+	return FALSE;
+}
+
+#if TL_TX_RING_SIZE
+/*
+ * With the transmit ring on, output is queued there instead of going to
+ * print/write, for the driver to take with tl_tx_peek() and
+ * tl_tx_consume(), from an interrupt handler if need be.
+ */
+void tl_set_tx_ring(t_tokenline *tl, int enable)
+{
+	tl_flush(tl);
+	tl->tx_ring = enable;
+}
+
+/*
+ * Returns the next contiguous chunk of output, and its length in len, or
+ * NULL if there's none. It stays queued until tl_tx_consume().
+ */
+const uint8_t *tl_tx_peek(t_tokenline *tl, size_t *len)
+{
+	uint32_t head, tail, pos;
+
+	head = tl->tx.head;
+	TL_RING_BARRIER();
+	tail = tl->tx.tail;
+	pos = tail & (TL_TX_RING_SIZE - 1);
+	*len = head - tail;
+	if (*len > TL_TX_RING_SIZE - pos)
+		*len = TL_TX_RING_SIZE - pos;
+
+	return *len ? tl->tx.buf + pos : NULL;
+}
+
+/* Free the first len bytes returned by tl_tx_peek(), once they're sent. */
+void tl_tx_consume(t_tokenline *tl, size_t len)
+{
+	TL_RING_BARRIER();
+	tl->tx.tail += len;
+}
+
+/* Bytes in the transmit ring, still to be sent. */
+size_t tl_tx_pending(t_tokenline *tl)
+{
+	return tl->tx.head - tl->tx.tail;
+}
+#endif
+
+/*
+ * In batch mode, lines fed through tl_input() and tl_input_buf() are only
+ * split, tokenized and dispatched: there's no echo, line editing, prompt
+ * or history, and errors are only recorded in tl->status.
+ */
+void tl_set_batch(t_tokenline *tl, int batch)
+{
+	tl->escape_state = ESC_NONE;
+	tl->batch = batch;
+	if (!batch) {
+		output(tl, tl->prompt);
+		output(tl, tl->buf);
+		tl_flush(tl);
+	}
+}
+
+/*
+ * Between tl_set_paste(tl, TRUE) and tl_set_paste(tl, FALSE), input is
+ * taken as pasted text: only printable characters, tabs and line ends
+ * count, and the line is redrawn once at the end instead of echoing every
+ * character. The bracketed paste markers do the same.
+ */
+void tl_set_paste(t_tokenline *tl, int paste)
+{
+	if (paste) {
+		paste_start(tl);
+	} else {
+		paste_end(tl);
+		tl_flush(tl);
+	}
+}
+
+/*
+ * Run a whole line as in batch mode, regardless of the current mode,
+ * and return its status. The line being edited, if any, is left alone.
+ * Not to be called from the callback.
+ */
+int tl_exec_line(t_tokenline *tl, const char *line, size_t len)
+{
+	t_tokenline_job job;
+	int batch;
+
+	while (len && (line[len - 1] == '\r' || line[len - 1] == '\n'))
+		len--;
+	if (len >= (size_t)tl->line_size) {
+		tl->status = TL_ERR_LINE_TOO_LONG;
+		return tl->status;
+	}
+
+	/* Leave a suspended command alone, this one won't be. */
+	job = tl->job;
+	tl->job.type = JOB_NONE;
+	batch = tl->batch;
+	tl->batch = TRUE;
+	exec_line(tl, line, len);
+	tl->batch = batch;
+	tl->job = job;
+	/* split_buf no longer holds what completion left there. */
+	line_changed(tl, 0);
+	tl_flush(tl);
+
+	return tl->status;
+}
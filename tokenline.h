@@ -18,15 +18,167 @@
 #ifndef TOKENLINE_H
 #define TOKENLINE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A board's own settings, as a header defining any of the ones below
+ * before their defaults are used, e.g. -DTL_CONFIG_HEADER='"tl_board.h"'.
+ */
+#ifdef TL_CONFIG_HEADER
+#include TL_CONFIG_HEADER
+#endif
+
+/*
+ * Features, 1 to build them in or 0 to leave their code and their state
+ * in t_tokenline out: the history with its search and the history
+ * command, the help command, Tab completion, T_ARG_FLOAT arguments,
+ * splitting words at the HydraBus special characters, and arg_views with
+ * the args array it fills in t_tokenline_parsed.
+ */
+#ifndef TL_CONFIG_HISTORY
+#define TL_CONFIG_HISTORY       1
+#endif
+#ifndef TL_CONFIG_HELP
+#define TL_CONFIG_HELP          1
+#endif
+#ifndef TL_CONFIG_COMPLETION
+#define TL_CONFIG_COMPLETION    1
+#endif
+#ifndef TL_CONFIG_FLOAT
+#define TL_CONFIG_FLOAT         1
+#endif
+#ifndef TL_CONFIG_SPECIAL_CHARS
+#define TL_CONFIG_SPECIAL_CHARS 1
+#endif
+#ifndef TL_CONFIG_ARG_VIEWS
+#define TL_CONFIG_ARG_VIEWS     1
+#endif
+
+#ifndef TL_MAX_LINE_LEN
 #define TL_MAX_LINE_LEN         128
-#define TL_MAX_ESCAPE_LEN       8
+#endif
+#ifndef TL_MAX_OUTPUT_LEN
+#define TL_MAX_OUTPUT_LEN       64
+#endif
+#ifndef TL_MAX_WORDS
 #define TL_MAX_WORDS            64
+#endif
+#ifndef TL_MAX_TOKEN_LEVELS
 #define TL_MAX_TOKEN_LEVELS     8
+#endif
+#ifndef TL_MAX_TOKEN_DEPTH
+#define TL_MAX_TOKEN_DEPTH      8
+#endif
+#ifndef TL_MAX_ARGS
+#define TL_MAX_ARGS             (TL_MAX_WORDS / 2)
+#endif
+#ifndef TL_MAX_HISTORY_SIZE
 #define TL_MAX_HISTORY_SIZE     512
+#endif
+#ifndef TL_MAX_HISTORY_ENTRIES
+#define TL_MAX_HISTORY_ENTRIES  64
+#endif
+#ifndef TL_MAX_SEARCH_LEN
+#define TL_MAX_SEARCH_LEN       32
+#endif
+/*
+ * Room tokenline-gen builds an index in, e.g. for TL_DEFINE_INDEX too. What
+ * it emits is sized to the tables.
+ */
+#ifndef TL_MAX_INDEX_TABLES
+#define TL_MAX_INDEX_TABLES     32
+#endif
+#ifndef TL_MAX_INDEX_ENTRIES
+#define TL_MAX_INDEX_ENTRIES    256
+#endif
+#ifndef TL_MAX_INDEX_SPECIAL
+#define TL_MAX_INDEX_SPECIAL    32
+#endif
+#ifndef TL_MAX_INDEX_KEYWORDS
+#define TL_MAX_INDEX_KEYWORDS   2048
+#endif
+#ifndef TL_TOKEN_DELIMITER
 #define TL_TOKEN_DELIMITER      ':'
+#endif
+/*
+ * Set to 0 to leave the buffers used by tl_init() out of t_tokenline, when
+ * all instances are set up with tl_init_buffers().
+ */
+#ifndef TL_EMBEDDED_BUFFERS
+#define TL_EMBEDDED_BUFFERS     1
+#endif
+#ifndef TL_ONE_COMMAND_PER_LINE
 #define TL_ONE_COMMAND_PER_LINE FALSE
+#endif
+#ifndef TL_ARG_VIEWS
+#define TL_ARG_VIEWS            FALSE
+#endif
+/* Separates several commands on one line, 0 for none. */
+#ifndef TL_COMMAND_SEPARATOR
+#define TL_COMMAND_SEPARATOR    ';'
+#endif
+/*
+ * Size of the receive ring filled by tl_rx_push() and drained by
+ * tl_poll(), a power of two. 0 leaves it out.
+ */
+#ifndef TL_RX_RING_SIZE
+#define TL_RX_RING_SIZE         64
+#endif
+/*
+ * Size of the transmit ring filled instead of calling print/write once
+ * tl_set_tx_ring() turns it on, and drained with tl_tx_peek() and
+ * tl_tx_consume(), a power of two. 0 leaves it out.
+ */
+#ifndef TL_TX_RING_SIZE
+#define TL_TX_RING_SIZE         128
+#endif
+/*
+ * Fractional bits of T_ARG_FIXED values, 0 to 31. TL_FIXED_ONE is 1.0 in
+ * that format.
+ */
+#ifndef TL_FIXED_FRAC_BITS
+#define TL_FIXED_FRAC_BITS      16
+#endif
+#define TL_FIXED_ONE            ((int64_t)1 << TL_FIXED_FRAC_BITS)
+/*
+ * Number of aliases defined with the alias command, and the room each
+ * has for the tokenized form of its commands. 0 leaves them out: each
+ * alias costs its cache and name in every t_tokenline.
+ */
+#ifndef TL_MAX_ALIASES
+#define TL_MAX_ALIASES          0
+#endif
+#ifndef TL_ALIAS_CACHE_SIZE
+#define TL_ALIAS_CACHE_SIZE     256
+#endif
+/*
+ * Returned by tl_input(), tl_input_buf() and tl_poll() when input was held
+ * back, see tl_tx_busy().
+ */
+#define TL_BUSY                 2
+
+/* Status of a processed line, see tl_exec_line(). */
+enum tl_status {
+	TL_OK,
+	TL_ERR_TOO_MANY_WORDS,
+	TL_ERR_UNMATCHED_QUOTE,
+	TL_ERR_TOO_MANY_ARGUMENTS,
+	TL_ERR_INVALID_NUMBER,
+	TL_ERR_SUFFIX_NOT_ALLOWED,
+	TL_ERR_INVALID_COMMAND,
+	TL_ERR_INVALID_VALUE,
+	TL_ERR_MISSING_ARGUMENT,
+	TL_ERR_INVALID_COUNT,
+	TL_ERR_NO_PREVIOUS_COMMAND,
+	TL_ERR_LINE_TOO_LONG,
+	TL_ERR_TOO_MANY_ALIASES,
+	TL_ERR_NO_SUCH_ALIAS,
+};
 
 enum {
 	/* Token can be optionally suffixed by delimiter and integer. */
@@ -35,46 +187,451 @@ enum {
 
 typedef struct token_dict {
 	int token;
-	char *tokenstr;
+	const char *tokenstr;
 } t_token_dict;
 
+struct tokenline_parsed;
+typedef void (*tl_handler)(void *user, struct tokenline_parsed *p);
+
 typedef struct token {
 	int token;
 	uint16_t arg_type;
 	uint16_t flags;
-	struct token *subtokens;
-	char *help;
-	char *help_full;
+	const struct token *subtokens;
+	const char *help;
+	const char *help_full;
+	/* Called instead of the callback for commands ending here. */
+	tl_handler handler;
 } t_token;
 
+/* An argument value, as stored when arg_views is set. */
+typedef struct tokenline_arg {
+	union {
+		uint32_t arg_uint;
+		float arg_float;
+		uint64_t arg_uint64;
+		int32_t arg_int;
+		/* Scaled by TL_FIXED_ONE. */
+		int64_t arg_fixed;
+		/* Points into the split line, and is NULL-terminated. */
+		const char *arg_string;
+	} u;
+	/* Length of arg_string. */
+	int len;
+} t_tokenline_arg;
+
+/*
+ * A tokenized command. The arrays are the caller's, see TL_DEFINE_PARSED:
+ * max_tokens, buf_size and max_args give their room, and num_tokens,
+ * buf_len and num_args how much of it the command uses. buf_len counts
+ * the terminator a string argument can end with.
+ */
 typedef struct tokenline_parsed {
-	int tokens[TL_MAX_WORDS];
-	char buf[TL_MAX_LINE_LEN];
-	t_token *last_token_entry;
+	int *tokens;
+	char *buf;
+#if TL_CONFIG_ARG_VIEWS
+	t_tokenline_arg *args;
+#endif
+	int max_tokens;
+	int buf_size;
+#if TL_CONFIG_ARG_VIEWS
+	int max_args;
+#endif
+	int num_tokens;
+	int buf_len;
+#if TL_CONFIG_ARG_VIEWS
+	int num_args;
+#endif
+	const t_token *last_token_entry;
+	/* Handler the command is dispatched to, or NULL for the callback. */
+	tl_handler handler;
 } t_tokenline_parsed;
 
+#if TL_CONFIG_ARG_VIEWS
+/*
+ * With arg_views set, the integer following a T_ARG_* entry in tokens is
+ * an index into args. These take the position i of the T_ARG_* entry.
+ */
+#define TL_ARG_UINT(p, i)        ((p)->args[(p)->tokens[(i) + 1]].u.arg_uint)
+#define TL_ARG_FLOAT(p, i)       ((p)->args[(p)->tokens[(i) + 1]].u.arg_float)
+#define TL_ARG_UINT64(p, i)      ((p)->args[(p)->tokens[(i) + 1]].u.arg_uint64)
+#define TL_ARG_INT(p, i)         ((p)->args[(p)->tokens[(i) + 1]].u.arg_int)
+#define TL_ARG_FIXED(p, i)       ((p)->args[(p)->tokens[(i) + 1]].u.arg_fixed)
+#define TL_ARG_STRING(p, i)      ((p)->args[(p)->tokens[(i) + 1]].u.arg_string)
+#define TL_ARG_STRING_LEN(p, i)  ((p)->args[(p)->tokens[(i) + 1]].len)
+#endif
+
+/*
+ * Define static arrays for a command of up to max_words tokens and
+ * buf_size bytes of arguments, and a t_tokenline_parsed called name
+ * using them. It has room for max_words / 2 argument views.
+ */
+#if TL_CONFIG_ARG_VIEWS
+#define TL_DEFINE_PARSED(name, max_words, buf_size) \
+	static int name##_tokens[max_words]; \
+	static char name##_buf[buf_size]; \
+	static t_tokenline_arg name##_args[(max_words) / 2 ? (max_words) / 2 : 1]; \
+	static t_tokenline_parsed name = { \
+		name##_tokens, name##_buf, name##_args, \
+		max_words, buf_size, (max_words) / 2, \
+	}
+#else
+#define TL_DEFINE_PARSED(name, max_words, buf_size) \
+	static int name##_tokens[max_words]; \
+	static char name##_buf[buf_size]; \
+	static t_tokenline_parsed name = { \
+		name##_tokens, name##_buf, max_words, buf_size, \
+	}
+#endif
+
+/*
+ * Keyword entry of an indexed table. Holds everything a lookup needs, so
+ * neither the token table nor the dictionary is touched until a match is
+ * found.
+ */
+typedef struct token_index_entry {
+	uint16_t token;
+	/* Position of the entry in its token table. */
+	uint16_t pos;
+	/* Offset of the NULL-terminated keyword in t_token_index.keywords. */
+	uint16_t keyword;
+	uint16_t len;
+} t_token_index_entry;
+
+/* Sorted lookup index for one token table. */
+typedef struct token_index_table {
+	const t_token *tokens;
+	/* Slice of t_token_index.entries belonging to this table. */
+	uint16_t start;
+	uint16_t count;
+	/* Position of the T_ARG_UINT / T_ARG_STRING entry, or -1. */
+	int16_t arg_uint;
+	int16_t arg_string;
+} t_token_index_table;
+
+/*
+ * Room for tl_index_add() to build an index in, see TL_DEFINE_INDEX. The
+ * special array can hold max_special keywords.
+ */
+typedef struct token_index_buffers {
+	t_token_index_table *tables;
+	int max_tables;
+	t_token_index_entry *entries;
+	int max_entries;
+	char *keywords;
+	int max_keywords;
+	uint16_t *special;
+	int max_special;
+} t_token_index_buffers;
+
+/*
+ * Points to arrays sized to the tables it indexes, holding no pointers
+ * other than to those tables and the dictionary, so an index can also be
+ * generated as const arrays and kept in flash along with them.
+ */
+typedef struct token_index {
+	const t_token_dict *token_dict;
+	int num_tables;
+	int num_entries;
+	const t_token_index_table *tables;
+	/* Per table, its keyword entries sorted by keyword. */
+	const t_token_index_entry *entries;
+	/* Keywords of all entries, each stored once. */
+	int keywords_len;
+	const char *keywords;
+	/*
+	 * Dictionary entries with a special character past their first
+	 * character, sorted by keyword. -1 if there were too many.
+	 */
+	int num_special;
+	const uint16_t *special;
+	/* Where tl_index_add() builds it, or NULL if it can't. */
+	const t_token_index_buffers *buffers;
+} t_token_index;
+
+/*
+ * Define static arrays for an index of up to max_tables tables with
+ * max_entries keywords between them, taking max_keywords bytes, and up to
+ * max_special special keywords. Also defines a t_token_index called name
+ * for tl_index_init() and tl_index_add() to build in.
+ */
+#define TL_DEFINE_INDEX(name, max_tables, max_entries, max_keywords, max_special) \
+	static t_token_index_table name##_tables[max_tables]; \
+	static t_token_index_entry name##_entries[max_entries]; \
+	static char name##_keywords[max_keywords]; \
+	static uint16_t name##_special[(max_special) ? (max_special) : 1]; \
+	static const t_token_index_buffers name##_buffers = { \
+		name##_tables, max_tables, name##_entries, max_entries, \
+		name##_keywords, max_keywords, name##_special, max_special, \
+	}; \
+	static t_token_index name = { \
+		NULL, 0, 0, name##_tables, name##_entries, 0, name##_keywords, \
+		0, name##_special, &name##_buffers, \
+	}
+
+typedef struct history_entry {
+	uint16_t offset;
+	uint16_t len;
+} t_history_entry;
+
+/* Where tokenize() is at, so it can pick up again later. */
+typedef struct tokenize_state {
+	const t_token *token_stack[TL_MAX_TOKEN_DEPTH];
+	int cur_tsp;
+	int cur_tp;
+	int cur_bufsize;
+	int cur_arg;
+	int arg_needed;
+	const t_token *arg_tokens;
+	int done;
+	/* Handler of the last token entry that has one. */
+	tl_handler handler;
+} t_tokenize_state;
+
+/* Phases timed when built with TL_PROFILE. */
+enum tl_phases {
+	TL_PHASE_SPLIT,
+	/* Includes TL_PHASE_FIND_TOKEN. */
+	TL_PHASE_TOKENIZE,
+	TL_PHASE_FIND_TOKEN,
+	TL_PHASE_CALLBACK,
+	TL_PHASE_PRINT,
+	TL_NUM_PHASES,
+};
+
+typedef struct phase_stats {
+	uint32_t count;
+	uint32_t total;
+	uint32_t max;
+} t_phase_stats;
+
+typedef struct tokenline_stats {
+	t_phase_stats phases[TL_NUM_PHASES];
+	uint32_t lines;
+	/* Bytes output per line, from one prompt to the next. */
+	uint32_t line_bytes;
+	uint32_t line_bytes_max;
+} t_tokenline_stats;
+
+/*
+ * Buffers for one instance, see tl_init_buffers(). line_size and max_words
+ * can't be more than TL_MAX_LINE_LEN and TL_MAX_WORDS.
+ */
+typedef struct tokenline_buffers {
+	char *line;
+	int line_size;
+	/* line_size + max_words bytes. */
+	char *split;
+	int *words;
+	int max_words;
+	/*
+	 * Can be shared by instances that never parse at the same time. Its
+	 * sizes limit the commands tokenized into it.
+	 */
+	t_tokenline_parsed *parsed;
+	/* No history if hist_size or hist_entries is 0. */
+	char *hist_buf;
+	int hist_size;
+	t_history_entry *hist_index;
+	int hist_entries;
+} t_tokenline_buffers;
+
+/* Define static buffers, and a t_tokenline_buffers called name using them. */
+#define TL_DEFINE_BUFFERS(name, line_size, max_words, hist_size, hist_entries) \
+	static char name##_line[line_size]; \
+	static char name##_split[(line_size) + (max_words)]; \
+	static int name##_words[max_words]; \
+	TL_DEFINE_PARSED(name##_parsed, max_words, line_size); \
+	static char name##_hist_buf[(hist_size) ? (hist_size) : 1]; \
+	static t_history_entry name##_hist_index[(hist_entries) ? (hist_entries) : 1]; \
+	static const t_tokenline_buffers name = { \
+		name##_line, line_size, name##_split, name##_words, max_words, \
+		&name##_parsed, name##_hist_buf, hist_size, \
+		name##_hist_index, hist_entries, \
+	}
+
+/*
+ * Built-in command whose output was suspended for lack of room in the
+ * transmit ring, and where it's at.
+ */
+typedef struct {
+	int type;
+	int pos;
+	const t_token *tokens;
+	/* Keyword column of a listing. */
+	int width;
+	/* Offset in buf of the commands to run after it, or -1. */
+	int rest;
+#if TL_MAX_ALIASES
+	/* The commands of the alias it's in to run before those, or NULL. */
+	const char *alias_rest;
+#endif
+} t_tokenline_job;
+
+#if TL_MAX_ALIASES
+typedef struct {
+	/* Name, NULL, then the commands it runs. Unused if empty. */
+	char line[TL_MAX_LINE_LEN];
+	/*
+	 * What the commands tokenize to, cache_len bytes of it, valid while
+	 * cache_gen is tl->alias_gen and arg_views is cache_views.
+	 */
+	uint32_t cache_gen;
+	int cache_len;
+#if TL_CONFIG_ARG_VIEWS
+	int cache_views;
+#endif
+	uint8_t cache[TL_ALIAS_CACHE_SIZE];
+} t_tokenline_alias;
+#endif
+
+typedef uint32_t (*tl_cyclefunc)(void);
 typedef void (*tl_printfunc)(void *user, const char *str);
+typedef void (*tl_writefunc)(void *user, const char *buf, size_t len);
 typedef void (*tl_callback)(void *user, t_tokenline_parsed *p);
 typedef struct tokenline {
-	t_token *token_levels[TL_MAX_TOKEN_LEVELS];
+	const t_token *token_levels[TL_MAX_TOKEN_LEVELS];
 	int token_level;
-	t_token_dict *token_dict;
+	const t_token_dict *token_dict;
+	const t_token_index *index;
 	tl_printfunc print;
+	tl_writefunc write;
 	void *user;
-	char buf[TL_MAX_LINE_LEN];
+	/* Output not yet handed to print/write, see tl_flush(). */
+	char out_buf[TL_MAX_OUTPUT_LEN + 1];
+	int out_len;
+	char *buf;
 	int buf_len;
-	char escape[TL_MAX_ESCAPE_LEN];
-	int escape_len;
-	char *prompt;
+	int line_size;
+	/* Words of the line, NULL-separated, as output by split_line_from(). */
+	char *split_buf;
+	int split_len;
+	int *words;
+	int num_words;
+	int max_words;
+	/* Position in buf where the last word starts. */
+	int word_pos;
+#if TL_CONFIG_COMPLETION
+	/*
+	 * Tokenizer state after the first tok_cache_words words, kept by
+	 * completion. Valid while the first tok_cache_len characters of the
+	 * line don't change; 0 if not valid.
+	 */
+	t_tokenize_state tok_cache;
+	const t_token *tok_cache_entry;
+	int tok_cache_words;
+	int tok_cache_pos;
+	int tok_cache_out;
+	int tok_cache_len;
+#endif
+	/* Escape sequence being decoded, see escape_input(). */
+	int escape_state;
+	uint16_t escape_param[2];
+	int escape_cur_param;
+	const char *prompt;
 	tl_callback callback;
 	int pos;
 	int one_command_per_line;
-	t_tokenline_parsed parsed;
+	char separator;
+#if TL_CONFIG_ARG_VIEWS
+	/* Return arguments in parsed.args instead of copying them to buf. */
+	int arg_views;
+#endif
+	/* No echo, prompt, history or error messages, see tl_set_batch(). */
+	int batch;
+	/* The batch line being collected didn't fit in buf. */
+	int batch_overflow;
+	/* Status of the last line processed. */
+	int status;
+	t_tokenline_parsed *parsed;
+#if TL_CONFIG_HISTORY
+	/* Number of entries back from the newest one, or -1. */
 	int hist_step;
-	int hist_begin;
-	int hist_end;
-	/* Need a terminating zero to print last chunk in ring buffer. */
-	char hist_buf[TL_MAX_HISTORY_SIZE + 1];
+	/* Ring of entries in hist_buf, starting with the oldest one. */
+	int hist_first;
+	int hist_count;
+	t_history_entry *hist_index;
+	int hist_entries;
+	char *hist_buf;
+	int hist_size;
+	/* Reverse incremental history search (Ctrl-r). */
+	int searching;
+	char search_buf[TL_MAX_SEARCH_LEN];
+	int search_len;
+	int search_match;
+#endif
+	/* Pasted text is taken as is, see tl_set_paste(). */
+	int paste;
+	/*
+	 * The screen shows the line up to echo_pos, the rest of its echo
+	 * is deferred; -1 if it's up to date. The prompt is still to be
+	 * shown if echo_prompt is set.
+	 */
+	int echo_pos;
+	int echo_prompt;
+#if TL_RX_RING_SIZE
+	/*
+	 * Single-producer, single-consumer ring: only tl_rx_push() writes
+	 * head and dropped, only tl_poll() writes tail. Both count bytes
+	 * since tl_init(), and wrap around.
+	 */
+	struct {
+		uint8_t buf[TL_RX_RING_SIZE];
+		volatile uint32_t head;
+		volatile uint32_t tail;
+		/* Bytes pushed while the ring was full. */
+		volatile uint32_t dropped;
+	} rx;
+#endif
+	t_tokenline_job job;
+	/* The command being run may be suspended. */
+	int job_resumable;
+#if TL_TX_RING_SIZE
+	/* Output goes to tx instead of print/write. */
+	int tx_ring;
+	/*
+	 * Single-producer, single-consumer ring: only tl_flush() writes
+	 * head and dropped, only tl_tx_consume() writes tail.
+	 */
+	struct {
+		uint8_t buf[TL_TX_RING_SIZE];
+		volatile uint32_t head;
+		volatile uint32_t tail;
+		/* Output bytes lost because the ring was full. */
+		volatile uint32_t dropped;
+	} tx;
+#endif
+#if TL_MAX_ALIASES
+	t_tokenline_alias aliases[TL_MAX_ALIASES];
+	/* Alias caches from another generation are stale. */
+	uint32_t alias_gen;
+	/* Alias whose cache is being filled, and whether one is running. */
+	t_tokenline_alias *alias_caching;
+	int alias_running;
+#endif
+#ifdef TL_PROFILE
+	tl_cyclefunc cycles;
+	t_tokenline_stats stats;
+	uint32_t cur_line_bytes;
+#endif
+#if TL_EMBEDDED_BUFFERS
+	/* Buffers set up by tl_init(). */
+	struct {
+		char line[TL_MAX_LINE_LEN];
+		char split[TL_MAX_LINE_LEN + TL_MAX_WORDS];
+		int words[TL_MAX_WORDS];
+		t_tokenline_parsed parsed;
+		int parsed_tokens[TL_MAX_WORDS];
+		char parsed_buf[TL_MAX_LINE_LEN];
+#if TL_CONFIG_ARG_VIEWS
+		t_tokenline_arg parsed_args[TL_MAX_ARGS];
+#endif
+#if TL_CONFIG_HISTORY
+		t_history_entry hist_index[TL_MAX_HISTORY_ENTRIES];
+		char hist_buf[TL_MAX_HISTORY_SIZE];
+#endif
+	} storage;
+#endif
 } t_tokenline;
 
 /* These share a number space with the tokens. */
@@ -89,15 +646,69 @@ enum token_argtypes {
 	/* Integer argument suffixed to token with delimiter and integer. */
 	T_ARG_TOKEN_SUFFIX_INT,
 	T_ARG_HELP,
+	/* 64-bit, e.g. for addresses. Also takes k, m or g. */
+	T_ARG_UINT64,
+	/* Signed 32-bit. Also takes k, m or g. */
+	T_ARG_INT,
+	/*
+	 * Signed fixed-point with TL_FIXED_FRAC_BITS fractional bits, e.g.
+	 * 1.5 or 2.4k. Parsed without floating point.
+	 */
+	T_ARG_FIXED,
 };
 
-void tl_init(t_tokenline *tl, t_token *tokens_top, t_token_dict *token_dict,
-		tl_printfunc printfunc, void *user);
-void tl_set_prompt(t_tokenline *tl, char *prompt);
+#if TL_EMBEDDED_BUFFERS
+void tl_init(t_tokenline *tl, const t_token *tokens_top,
+		const t_token_dict *token_dict, tl_printfunc printfunc, void *user);
+#endif
+void tl_init_buffers(t_tokenline *tl, const t_token *tokens_top,
+		const t_token_dict *token_dict, tl_printfunc printfunc, void *user,
+		const t_tokenline_buffers *buffers);
+void tl_set_prompt(t_tokenline *tl, const char *prompt);
+void tl_set_writefunc(t_tokenline *tl, tl_writefunc writefunc);
+void tl_flush(t_tokenline *tl);
 void tl_set_callback(t_tokenline *tl, tl_callback callback);
-int tl_mode_push(t_tokenline *tl, t_token *tokens_mode);
+int tl_capture(t_tokenline *tl, t_tokenline_parsed *p);
+void tl_replay(t_tokenline *tl, t_tokenline_parsed *p);
+int tl_mode_push(t_tokenline *tl, const t_token *tokens_mode);
 int tl_mode_pop(t_tokenline *tl);
+#if TL_CONFIG_HISTORY
+size_t tl_history_image_size(t_tokenline *tl);
+size_t tl_history_export(t_tokenline *tl, void *image, size_t size);
+int tl_history_import(t_tokenline *tl, const void *image, size_t size);
+#endif
 int tl_input(t_tokenline *tl, uint8_t c);
+int tl_input_buf(t_tokenline *tl, const uint8_t *buf, size_t len,
+		size_t *used);
+void tl_set_batch(t_tokenline *tl, int batch);
+void tl_set_paste(t_tokenline *tl, int paste);
+int tl_exec_line(t_tokenline *tl, const char *line, size_t len);
+#if TL_RX_RING_SIZE
+int tl_rx_push(t_tokenline *tl, uint8_t c);
+int tl_poll(t_tokenline *tl);
+#endif
+int tl_tx_busy(t_tokenline *tl);
+#if TL_TX_RING_SIZE
+void tl_set_tx_ring(t_tokenline *tl, int enable);
+const uint8_t *tl_tx_peek(t_tokenline *tl, size_t *len);
+void tl_tx_consume(t_tokenline *tl, size_t len);
+size_t tl_tx_pending(t_tokenline *tl);
+#endif
+void tl_index_init(t_token_index *index, const t_token_dict *token_dict);
+int tl_index_add(t_token_index *index, const t_token *tokens);
+void tl_set_index(t_tokenline *tl, const t_token_index *index);
+#if TL_MAX_ALIASES
+void tl_tables_changed(t_tokenline *tl);
+#endif
+#ifdef TL_PROFILE
+void tl_set_cyclefunc(t_tokenline *tl, tl_cyclefunc cyclefunc);
+void tl_stats_get(t_tokenline *tl, t_tokenline_stats *stats);
+void tl_stats_reset(t_tokenline *tl);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
 
 #ifndef NULL
 #define NULL 0
@@ -0,0 +1,556 @@
+/*
+ * Copyright (C) 2014 Bert Vermeulen <bert@biot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Optional C++17 interface: the command tree is declared as a constexpr
+ * value, from which the dictionary, token tables and token index are
+ * computed at compile time. Handlers take the command's arguments as
+ * typed parameters. Nothing is allocated, and all tables are constants.
+ *
+ *	static constexpr auto tree = tl::commands(
+ *		tl::cmd("show", "Show information").sub(
+ *			tl::cmd("version", "Version").handle([] { ... }),
+ *			tl::cmd("device", "Device").arg<uint32_t>()
+ *				.handle([](uint32_t n) { ... })),
+ *		tl::cmd("name", "Set name").arg<std::string_view>()
+ *			.handle([](void *user, std::string_view s) { ... }));
+ *
+ *	tl::cli<tree> cli;
+ *	cli.init(print, &ctx);
+ */
+
+#ifndef TOKENLINE_HPP
+#define TOKENLINE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "tokenline.h"
+
+/* Handlers read their arguments from parsed.args. */
+#if !TL_CONFIG_ARG_VIEWS
+#error "tokenline.hpp needs TL_CONFIG_ARG_VIEWS"
+#endif
+
+namespace tl {
+
+/* A T_ARG_FIXED argument, scaled by TL_FIXED_ONE. */
+struct fixed {
+	int64_t raw;
+};
+
+namespace detail {
+
+struct no_handler {
+};
+
+template <typename T>
+constexpr uint16_t arg_type()
+{
+	if constexpr (std::is_void_v<T>)
+		return 0;
+	else if constexpr (std::is_same_v<T, uint32_t>)
+		return T_ARG_UINT;
+	else if constexpr (std::is_same_v<T, float>)
+		return T_ARG_FLOAT;
+	else if constexpr (std::is_same_v<T, std::string_view>)
+		return T_ARG_STRING;
+	else if constexpr (std::is_same_v<T, uint64_t>)
+		return T_ARG_UINT64;
+	else if constexpr (std::is_same_v<T, int32_t>)
+		return T_ARG_INT;
+	else if constexpr (std::is_same_v<T, fixed>)
+		return T_ARG_FIXED;
+	else
+		static_assert(std::is_void_v<T>,
+				"Arguments are uint32_t, uint64_t, int32_t, tl::fixed, float or std::string_view.");
+}
+
+constexpr int str_cmp(const char *a, const char *b)
+{
+	while (*a && *a == *b) {
+		a++;
+		b++;
+	}
+
+	return (unsigned char)*a - (unsigned char)*b;
+}
+
+constexpr int str_len(const char *s)
+{
+	int len = 0;
+
+	for (; s[len]; len++)
+		;
+
+	return len;
+}
+
+} /* namespace detail */
+
+/*
+ * A keyword, the type of the argument following it, its handler and its
+ * subtokens. Built with cmd() and the member functions below.
+ */
+template <typename Arg, typename Handler, typename... Children>
+struct node {
+	const char *keyword;
+	const char *help;
+	const char *help_full;
+	Handler handler;
+	std::tuple<Children...> children;
+
+	/*
+	 * Take an argument of type uint32_t, uint64_t, int32_t, tl::fixed,
+	 * float or std::string_view.
+	 */
+	template <typename T>
+	constexpr node<T, Handler, Children...> arg() const
+	{
+		static_assert(std::is_void_v<Arg>, "A keyword takes only one argument.");
+		static_assert(sizeof...(Children) == 0, "A keyword with subtokens takes no argument.");
+		detail::arg_type<T>();
+		return { keyword, help, help_full, handler, children };
+	}
+
+	/*
+	 * Called with the arguments of this keyword and the ones before it,
+	 * optionally preceded by the user pointer, for commands ending here or
+	 * in subtokens without a handler of their own.
+	 */
+	template <typename F>
+	constexpr node<Arg, F, Children...> handle(F f) const
+	{
+		static_assert(std::is_same_v<Handler, detail::no_handler>,
+				"A keyword has only one handler.");
+		return { keyword, help, help_full, f, children };
+	}
+
+	template <typename... C>
+	constexpr node<Arg, Handler, C...> sub(C... c) const
+	{
+		static_assert(sizeof...(Children) == 0, "Subtokens are already set.");
+		static_assert(std::is_void_v<Arg>, "A keyword with an argument has no subtokens.");
+		return { keyword, help, help_full, handler, std::tuple<C...>(c...) };
+	}
+
+	constexpr node full_help(const char *s) const
+	{
+		return { keyword, help, s, handler, children };
+	}
+};
+
+constexpr node<void, detail::no_handler> cmd(const char *keyword,
+		const char *help = nullptr)
+{
+	return { keyword, help, nullptr, {}, {} };
+}
+
+/* The top-level table. */
+template <typename... C>
+constexpr node<void, detail::no_handler, C...> commands(C... c)
+{
+	static_assert(sizeof...(C) > 0, "No commands.");
+	return { nullptr, nullptr, nullptr, {}, std::tuple<C...>(c...) };
+}
+
+namespace detail {
+
+template <typename N>
+struct info;
+
+template <typename A, typename H, typename... C>
+struct info<node<A, H, C...>> {
+	using arg = A;
+	using handler = H;
+	static constexpr size_t num_children = sizeof...(C);
+	/* Keywords below this node, and tables at or below it. */
+	static constexpr size_t nodes = (0 + ... + (1 + info<C>::nodes));
+	static constexpr size_t tables = (num_children > 0) + (0 + ... + info<C>::tables);
+	template <size_t I>
+	using child = std::tuple_element_t<I, std::tuple<C...>>;
+};
+
+template <typename N>
+constexpr const N &at(const N &n)
+{
+	return n;
+}
+
+template <size_t I, size_t... Rest, typename N>
+constexpr const auto &at(const N &n)
+{
+	return at<Rest...>(std::get<I>(n.children));
+}
+
+template <const auto &Tree, size_t... Path>
+using node_at = std::remove_cv_t<std::remove_reference_t<decltype(at<Path...>(Tree))>>;
+
+/* Argument types of the keywords along a path, as a tuple. */
+template <typename N, size_t... Path>
+struct path_args {
+	using type = std::tuple<>;
+};
+
+template <typename N, size_t I, size_t... Rest>
+struct path_args<N, I, Rest...> {
+	using child = typename info<N>::template child<I>;
+	using own = std::conditional_t<std::is_void_v<typename info<child>::arg>,
+			std::tuple<>, std::tuple<typename info<child>::arg>>;
+	using type = decltype(std::tuple_cat(std::declval<own>(),
+			std::declval<typename path_args<child, Rest...>::type>()));
+};
+
+/* Keywords in tree order, with duplicates. */
+template <typename N, size_t M>
+constexpr void collect(const N &n, std::array<const char *, M> &out, size_t &k)
+{
+	std::apply([&](const auto &... c) {
+		((out[k++] = c.keyword, collect(c, out, k)), ...);
+	}, n.children);
+}
+
+template <const auto &Tree>
+constexpr std::array<t_token_dict, info<node_at<Tree>>::nodes + 2> make_dict()
+{
+	std::array<const char *, info<node_at<Tree>>::nodes> keywords{};
+	std::array<t_token_dict, info<node_at<Tree>>::nodes + 2> dict{};
+	size_t k = 0, n = 1, i = 0, j = 0;
+
+	collect(Tree, keywords, k);
+	for (i = 0; i < k; i++) {
+		for (j = 1; j < n; j++) {
+			if (!str_cmp(dict[j].tokenstr, keywords[i]))
+				break;
+		}
+		if (j == n) {
+			dict[n].token = n;
+			dict[n].tokenstr = keywords[i];
+			n++;
+		}
+	}
+
+	return dict;
+}
+
+template <const auto &Tree>
+struct dict_of {
+	/* Entry 0 is unused, and the list ends with an all-zero entry. */
+	static constexpr std::array<t_token_dict, info<node_at<Tree>>::nodes + 2> value =
+			make_dict<Tree>();
+};
+
+template <const auto &Tree>
+constexpr int token(const char *keyword)
+{
+	const auto &dict = dict_of<Tree>::value;
+	int i = 1;
+
+	for (; dict[i].token; i++) {
+		if (!str_cmp(dict[i].tokenstr, keyword))
+			break;
+	}
+
+	return i;
+}
+
+template <typename T>
+T get_arg(const t_tokenline_parsed *p, size_t i)
+{
+	if constexpr (std::is_same_v<T, uint32_t>)
+		return p->args[i].u.arg_uint;
+	else if constexpr (std::is_same_v<T, float>)
+		return p->args[i].u.arg_float;
+	else if constexpr (std::is_same_v<T, uint64_t>)
+		return p->args[i].u.arg_uint64;
+	else if constexpr (std::is_same_v<T, int32_t>)
+		return p->args[i].u.arg_int;
+	else if constexpr (std::is_same_v<T, fixed>)
+		return fixed{ p->args[i].u.arg_fixed };
+	else
+		return std::string_view(p->args[i].u.arg_string, p->args[i].len);
+}
+
+template <typename H, typename... Args, size_t... I>
+void call(const H &handler, void *user, const t_tokenline_parsed *p,
+		std::tuple<Args...> *, std::index_sequence<I...>)
+{
+	if constexpr (std::is_invocable_v<const H &, void *, Args...>) {
+		handler(user, get_arg<Args>(p, I)...);
+	} else {
+		static_assert(std::is_invocable_v<const H &, Args...>,
+				"Handler doesn't take the command's arguments.");
+		(void)user;
+		(void)p;
+		handler(get_arg<Args>(p, I)...);
+	}
+}
+
+/*
+ * The handler in the token table. Arguments are in line order in args, so
+ * the ones of the keywords on the path to the handler come first.
+ */
+template <const auto &Tree, size_t... Path>
+void thunk(void *user, t_tokenline_parsed *p)
+{
+	using args = typename path_args<node_at<Tree>, Path...>::type;
+
+	call(at<Path...>(Tree).handler, user, p, (args *)nullptr,
+			std::make_index_sequence<std::tuple_size_v<args>>{});
+}
+
+template <const auto &Tree, size_t... Path>
+struct table_of;
+
+template <const auto &Tree, size_t... Path>
+constexpr t_token entry()
+{
+	using n = node_at<Tree, Path...>;
+	const n &node = at<Path...>(Tree);
+	t_token t{};
+
+	t.token = token<Tree>(node.keyword);
+	t.arg_type = arg_type<typename info<n>::arg>();
+	t.help = node.help;
+	t.help_full = node.help_full;
+	if constexpr (info<n>::num_children > 0)
+		t.subtokens = table_of<Tree, Path...>::value.data();
+	if constexpr (!std::is_same_v<typename info<n>::handler, no_handler>)
+		t.handler = thunk<Tree, Path...>;
+
+	return t;
+}
+
+template <const auto &Tree, size_t... Path, size_t... I>
+constexpr std::array<t_token, sizeof...(I) + 1> make_table(std::index_sequence<I...>)
+{
+	return { entry<Tree, Path..., I>()..., t_token{} };
+}
+
+/* The token table made of a node's subtokens. */
+template <const auto &Tree, size_t... Path>
+struct table_of {
+	static constexpr size_t size = info<node_at<Tree, Path...>>::num_children;
+	static constexpr std::array<t_token, size + 1> value =
+			make_table<Tree, Path...>(std::make_index_sequence<size>{});
+};
+
+constexpr int is_special(char c)
+{
+	/* Same as char_class in tokenline.c. */
+	const char *s = "[]{}/\\_-!^.&%~\"";
+
+	for (; *s; s++) {
+		if (*s == c)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Bytes the dictionary's keywords take, each stored once with its 0. */
+template <const auto &Tree>
+constexpr size_t keywords_size()
+{
+	const auto &dict = dict_of<Tree>::value;
+	size_t size = 0;
+	int i = 1;
+
+	for (; dict[i].token; i++)
+		size += str_len(dict[i].tokenstr) + 1;
+
+	return size;
+}
+
+/* The arrays of an index, sized to the tree; see index_of. */
+template <const auto &Tree>
+struct index_data {
+	using root = node_at<Tree>;
+
+	std::array<t_token_index_table, info<root>::tables> tables;
+	std::array<t_token_index_entry, info<root>::nodes> entries;
+	std::array<char, keywords_size<Tree>()> keywords;
+	std::array<uint16_t, info<root>::nodes> special;
+	int num_tables;
+	int num_entries;
+	int keywords_len;
+	int num_special;
+};
+
+/* The same as tl_index_add() does for one table, at compile time. */
+template <typename D>
+constexpr void index_table(D &index, const t_token_dict *dict,
+		const t_token *tokens)
+{
+	t_token_index_table &table = index.tables[index.num_tables++];
+	t_token_index_entry *entries = index.entries.data() + index.num_entries;
+	t_token_index_entry e{};
+	const char *s = nullptr;
+	int count = 0, i = 0, j = 0, len = 0;
+
+	table.tokens = tokens;
+	table.start = index.num_entries;
+	table.arg_uint = -1;
+	table.arg_string = -1;
+	for (; tokens[i].token; i++) {
+		if (tokens[i].token >= T_ARG_UINT)
+			continue;
+		e.token = tokens[i].token;
+		e.pos = i;
+		for (j = 0; j < index.num_entries + count; j++) {
+			if (index.entries[j].token == e.token)
+				break;
+		}
+		if (j < index.num_entries + count) {
+			e.keyword = index.entries[j].keyword;
+		} else {
+			s = dict[e.token].tokenstr;
+			len = str_len(s);
+			e.keyword = index.keywords_len;
+			for (j = 0; j <= len; j++)
+				index.keywords[index.keywords_len++] = s[j];
+		}
+		s = index.keywords.data() + e.keyword;
+		e.len = str_len(s);
+		for (j = count; j > 0; j--) {
+			if (str_cmp(index.keywords.data() + entries[j - 1].keyword, s) <= 0)
+				break;
+			entries[j] = entries[j - 1];
+		}
+		entries[j] = e;
+		count++;
+	}
+	table.count = count;
+	index.num_entries += count;
+}
+
+template <const auto &Tree, size_t... Path, size_t... I>
+constexpr void index_tables(index_data<Tree> &index, std::index_sequence<I...>)
+{
+	if constexpr (sizeof...(I) > 0) {
+		index_table(index, dict_of<Tree>::value.data(),
+				table_of<Tree, Path...>::value.data());
+		(index_tables<Tree, Path..., I>(index, std::make_index_sequence<
+				info<node_at<Tree, Path..., I>>::num_children>{}), ...);
+	}
+}
+
+template <const auto &Tree>
+constexpr index_data<Tree> make_index()
+{
+	using root = node_at<Tree>;
+	const t_token_dict *dict = dict_of<Tree>::value.data();
+	index_data<Tree> index{};
+	const char *s = nullptr;
+	int x = 1, i = 0, j = 0;
+	uint16_t e = 0;
+
+	index_tables<Tree>(index, std::make_index_sequence<info<root>::num_children>{});
+
+	/* Keywords split_line_from() must not break apart. */
+	for (; dict[x].token; x++) {
+		s = dict[x].tokenstr;
+		for (i = 1; s[i]; i++) {
+			if (is_special(s[i]))
+				break;
+		}
+		if (!s[i])
+			continue;
+		for (j = index.num_special; j > 0; j--) {
+			e = index.special[j - 1];
+			if (str_cmp(dict[e].tokenstr, s) <= 0)
+				break;
+			index.special[j] = e;
+		}
+		index.special[j] = x;
+		index.num_special++;
+	}
+
+	return index;
+}
+
+/* The index, pointing at arrays that take no more than the tree needs. */
+template <const auto &Tree>
+struct index_of {
+	static constexpr index_data<Tree> data = make_index<Tree>();
+	static constexpr t_token_index value = {
+		dict_of<Tree>::value.data(), data.num_tables, data.num_entries,
+		data.tables.data(), data.entries.data(), data.keywords_len,
+		data.keywords.data(), data.num_special, data.special.data(),
+		nullptr,
+	};
+};
+
+} /* namespace detail */
+
+/*
+ * A t_tokenline instance using the tables computed from the tree. Set it
+ * up with init(); the instance itself is available as tl for the rest of
+ * the C API.
+ */
+template <const auto &Tree>
+class cli {
+public:
+	static constexpr const t_token_dict *dict = detail::dict_of<Tree>::value.data();
+	static constexpr const t_token *tokens = detail::table_of<Tree>::value.data();
+	static constexpr const t_token_index *index = &detail::index_of<Tree>::value;
+
+	t_tokenline tl;
+
+	/*
+	 * Commands without a handler go to the callback, which can be set
+	 * with tl_set_callback(). Arguments are always stored as views.
+	 * The handlers read them from args[0] on, so each command must be
+	 * alone in its parse: keywords past a complete command are refused,
+	 * and several commands on one line need the separator.
+	 */
+	void init(tl_printfunc printfunc, void *user = nullptr)
+	{
+		tl_init(&tl, tokens, dict, printfunc, user);
+		tl.arg_views = TRUE;
+		tl.one_command_per_line = TRUE;
+		tl_set_index(&tl, index);
+	}
+
+	void set_prompt(const char *prompt)
+	{
+		tl_set_prompt(&tl, prompt);
+	}
+
+	int input(uint8_t c)
+	{
+		return tl_input(&tl, c);
+	}
+
+	int input(const uint8_t *buf, size_t len, size_t *used = nullptr)
+	{
+		return tl_input_buf(&tl, buf, len, used);
+	}
+
+	int exec(std::string_view line)
+	{
+		return tl_exec_line(&tl, line.data(), line.size());
+	}
+};
+
+} /* namespace tl */
+
+#endif
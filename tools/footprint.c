@@ -15,26 +15,18 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-enum {
-	T_SHOW = 1,
-	T_SET,
-	T_HARDWARE,
-	T_VERSION,
-	T_DEVICE,
-	T_DIRECTORY,
-	T_HELP,
-	T_CPU,
-	T_MEMORY,
-	T_FREQUENCY,
-	T_NUMBER,
-	T_MKDIR,
-	T_LS,
-	T_TAP,
-	T_CALC,
-	T_PLUS,
-	T_EXIT,
-	T_LED,
-	T_ON,
-	T_OFF,
-};
+/*
+ * Prints sizeof(t_tokenline) for the footprint report, see the Makefile.
+ * Built with the same flags as the tokenline.c it's reported with.
+ */
+
+#include <stdio.h>
+
+#include "tokenline.h"
+
+int main(void)
+{
+	printf("%u\n", (unsigned int)sizeof(t_tokenline));
 
+	return 0;
+}
@@ -0,0 +1,882 @@
+/*
+ * Copyright (C) 2014 Bert Vermeulen <bert@biot.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Build-time generator: turns a command tree description into the token
+ * enum, dictionary, token tables and a const token index.
+ *
+ * Usage: tokenline-gen [-d dict] [-i index] input.tl output.c output.h
+ *   -d  name of the dictionary, default "dict"
+ *   -i  name of the index, default "token_index"
+ *
+ * The description is made up of tables, each starting with a line holding
+ * the table's name in brackets. Every line after that is one entry: a
+ * keyword or an argument type, optionally followed by attributes and then
+ * the help and full help strings, in double quotes. Lines indented by one
+ * more tab than the entry above them make up its subtokens table.
+ *
+ *	[tokens]
+ *	show		"Show information"
+ *		version		"Version"
+ *		device <integer>	"Device"
+ *	led <token> handler=cmd_led	"LED control"
+ *		on
+ *		off
+ *	calc tokens=tokens_mode_calc	"Calculator"
+ *
+ *	[tokens_mode_calc]
+ *	<integer>	"Operand"
+ *	+ enum=T_PLUS
+ *
+ * Attributes are:
+ *   <integer> <float> <string> <token> <help> <integer64> <signed> <fixed>
+ *                   the keyword's arg_type
+ *   suffix          allow a TL_TOKEN_DELIMITER and integer suffix
+ *   handler=name    handler function, declared by the generated code
+ *   tokens=table    use the named table as subtokens
+ *   enum=name       enum name, by default T_ followed by the keyword in
+ *                   upper case, with any other characters replaced by _
+ * An entry with just an argument type stands for a free-standing argument.
+ *
+ * Named tables are exported, the ones made from indented entries are
+ * static and named after their parent. Keywords are numbered in order of
+ * appearance, and the dictionary is put in that same order. Duplicate
+ * keywords in a table are an error; a keyword that is the start of
+ * another in the same table, and so can't be abbreviated, gets a warning.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "tokenline.h"
+
+#define MAX_LINE      1024
+#define MAX_KEYWORDS  1024
+#define MAX_TABLES    256
+#define MAX_DEPTH     32
+
+struct keyword {
+	char *str;
+	char *name;
+	int line;
+};
+
+struct entry {
+	int token;
+	int arg_type;
+	int flags;
+	/* Subtokens table, or -1. */
+	int sub;
+	char *sub_name;
+	char *help;
+	char *help_full;
+	char *handler;
+	int line;
+};
+
+struct table {
+	char *name;
+	int exported;
+	int line;
+	struct entry *entries;
+	int num_entries;
+	/* The table as tokenline sees it, for building the index. */
+	t_token *tokens;
+	int emitted;
+};
+
+static const char *arg_types[] = {
+	[T_ARG_UINT - T_ARG_UINT] = "integer",
+	[T_ARG_FLOAT - T_ARG_UINT] = "float",
+	[T_ARG_STRING - T_ARG_UINT] = "string",
+	[T_ARG_TOKEN - T_ARG_UINT] = "token",
+	[T_ARG_HELP - T_ARG_UINT] = "help",
+	[T_ARG_UINT64 - T_ARG_UINT] = "integer64",
+	[T_ARG_INT - T_ARG_UINT] = "signed",
+	[T_ARG_FIXED - T_ARG_UINT] = "fixed",
+};
+
+static const char *arg_names[] = {
+	[T_ARG_UINT - T_ARG_UINT] = "T_ARG_UINT",
+	[T_ARG_FLOAT - T_ARG_UINT] = "T_ARG_FLOAT",
+	[T_ARG_STRING - T_ARG_UINT] = "T_ARG_STRING",
+	[T_ARG_TOKEN - T_ARG_UINT] = "T_ARG_TOKEN",
+	[T_ARG_TOKEN_SUFFIX_INT - T_ARG_UINT] = "T_ARG_TOKEN_SUFFIX_INT",
+	[T_ARG_HELP - T_ARG_UINT] = "T_ARG_HELP",
+	[T_ARG_UINT64 - T_ARG_UINT] = "T_ARG_UINT64",
+	[T_ARG_INT - T_ARG_UINT] = "T_ARG_INT",
+	[T_ARG_FIXED - T_ARG_UINT] = "T_ARG_FIXED",
+};
+
+static const char *input_name;
+static struct keyword keywords[MAX_KEYWORDS];
+/* Entry 0 is unused, as it is in the dictionary. */
+static int num_keywords = 1;
+static struct table tables[MAX_TABLES];
+static int num_tables;
+static t_token_dict dict[MAX_KEYWORDS + 1];
+TL_DEFINE_INDEX(token_index, TL_MAX_INDEX_TABLES, TL_MAX_INDEX_ENTRIES,
+		TL_MAX_INDEX_KEYWORDS, TL_MAX_INDEX_SPECIAL);
+static int errors;
+
+static void error(int line, const char *msg, const char *arg)
+{
+	fprintf(stderr, "%s:%d: error: ", input_name, line);
+	fprintf(stderr, msg, arg);
+	fprintf(stderr, "\n");
+	errors++;
+}
+
+static void warning(int line, const char *msg, const char *arg1,
+		const char *arg2)
+{
+	fprintf(stderr, "%s:%d: warning: ", input_name, line);
+	fprintf(stderr, msg, arg1, arg2);
+	fprintf(stderr, "\n");
+}
+
+static char *xstrdup(const char *s)
+{
+	char *d;
+
+	if (!(d = strdup(s))) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	return d;
+}
+
+static int is_identifier(const char *s)
+{
+	int i;
+
+	if (!isalpha((unsigned char)s[0]) && s[0] != '_')
+		return FALSE;
+	for (i = 1; s[i]; i++) {
+		if (!isalnum((unsigned char)s[i]) && s[i] != '_')
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Argument type named by a word like "<integer>", or 0. */
+static int arg_type(const char *word)
+{
+	unsigned int i;
+	int len;
+
+	len = strlen(word);
+	if (word[0] != '<' || word[len - 1] != '>')
+		return 0;
+	for (i = 0; i < sizeof(arg_types) / sizeof(arg_types[0]); i++) {
+		if (arg_types[i] && (int)strlen(arg_types[i]) == len - 2
+				&& !strncmp(word + 1, arg_types[i], len - 2))
+			return T_ARG_UINT + i;
+	}
+
+	return -1;
+}
+
+static const char *token_name(int token)
+{
+	if (token >= T_ARG_UINT)
+		return arg_names[token - T_ARG_UINT];
+
+	return keywords[token].name;
+}
+
+static int find_table(const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_tables; i++) {
+		if (!strcmp(tables[i].name, name))
+			return i;
+	}
+
+	return -1;
+}
+
+static int add_table(const char *name, int exported, int line)
+{
+	if (find_table(name) != -1) {
+		error(line, "Table %s is already defined.", name);
+		return -1;
+	}
+	if (num_tables == MAX_TABLES) {
+		error(line, "Too many tables.", NULL);
+		return -1;
+	}
+	tables[num_tables].name = xstrdup(name);
+	tables[num_tables].exported = exported;
+	tables[num_tables].line = line;
+
+	return num_tables++;
+}
+
+static struct entry *add_entry(int t)
+{
+	struct table *table;
+
+	table = &tables[t];
+	table->entries = realloc(table->entries,
+			(table->num_entries + 1) * sizeof(struct entry));
+	if (!table->entries) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	memset(&table->entries[table->num_entries], 0, sizeof(struct entry));
+	table->entries[table->num_entries].sub = -1;
+
+	return &table->entries[table->num_entries++];
+}
+
+/* Token number of the keyword, which is added if it's new. */
+static int add_keyword(const char *str, const char *name, int line)
+{
+	char buf[MAX_LINE];
+	int alnum, i;
+
+	for (i = 1; i < num_keywords; i++) {
+		if (!strcmp(keywords[i].str, str))
+			break;
+	}
+	if (i < num_keywords) {
+		if (name && strcmp(keywords[i].name, name)) {
+			error(line, "Keyword '%s' was given another enum name before.", str);
+			return -1;
+		}
+		return i;
+	}
+
+	if (!name) {
+		alnum = FALSE;
+		strcpy(buf, "T_");
+		for (i = 0; str[i]; i++) {
+			if (isalnum((unsigned char)str[i])) {
+				buf[i + 2] = toupper((unsigned char)str[i]);
+				alnum = TRUE;
+			} else {
+				buf[i + 2] = '_';
+			}
+		}
+		buf[i + 2] = 0;
+		if (!alnum) {
+			error(line, "Keyword '%s' needs an enum= name.", str);
+			return -1;
+		}
+		name = buf;
+	} else if (!is_identifier(name)) {
+		error(line, "Invalid enum name %s.", name);
+		return -1;
+	}
+	for (i = 1; i < num_keywords; i++) {
+		if (!strcmp(keywords[i].name, name)) {
+			error(line, "Enum name %s is used for two keywords.", name);
+			return -1;
+		}
+	}
+	if (num_keywords == MAX_KEYWORDS) {
+		error(line, "Too many keywords.", NULL);
+		return -1;
+	}
+	keywords[num_keywords].str = xstrdup(str);
+	keywords[num_keywords].name = xstrdup(name);
+	keywords[num_keywords].line = line;
+
+	return num_keywords++;
+}
+
+/*
+ * Split off the next word, or quoted string without its quotes, at *s.
+ * Escapes in strings are kept, as they end up in C strings again.
+ */
+static char *next_word(char **s, int *quoted, int line)
+{
+	char *p, *word;
+
+	p = *s;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (!*p)
+		return NULL;
+
+	*quoted = *p == '"';
+	if (*quoted) {
+		word = ++p;
+		while (*p && *p != '"') {
+			if (*p == '\\' && p[1])
+				p++;
+			p++;
+		}
+		if (!*p) {
+			error(line, "Unterminated string.", NULL);
+			return NULL;
+		}
+	} else {
+		word = p;
+		while (*p && *p != ' ' && *p != '\t')
+			p++;
+	}
+	if (*p)
+		*p++ = 0;
+	*s = p;
+
+	return word;
+}
+
+static void parse_entry(struct entry *e, char *s, int line)
+{
+	char *word, *name, *keyword;
+	int quoted, type;
+
+	e->line = line;
+	keyword = next_word(&s, &quoted, line);
+	if (quoted) {
+		error(line, "Entry starts with a string.", NULL);
+		return;
+	}
+	if ((type = arg_type(keyword))) {
+		if (type == -1) {
+			error(line, "Unknown argument type %s.", keyword);
+			return;
+		}
+		if (type != T_ARG_UINT && type != T_ARG_FLOAT && type != T_ARG_STRING) {
+			error(line, "Argument type %s can't be an entry.", keyword);
+			return;
+		}
+		e->token = type;
+		keyword = NULL;
+	} else if (strchr(keyword, '"')) {
+		error(line, "Keyword %s contains a quote.", keyword);
+		return;
+	}
+
+	name = NULL;
+	while ((word = next_word(&s, &quoted, line))) {
+		if (quoted) {
+			if (!e->help) {
+				e->help = xstrdup(word);
+			} else if (!e->help_full) {
+				e->help_full = xstrdup(word);
+			} else {
+				error(line, "Too many strings.", NULL);
+				return;
+			}
+		} else if (e->help) {
+			error(line, "Attribute %s after the help text.", word);
+			return;
+		} else if ((type = arg_type(word))) {
+			if (type == -1) {
+				error(line, "Unknown argument type %s.", word);
+				return;
+			}
+			if (keyword == NULL || e->arg_type) {
+				error(line, "Unexpected argument type %s.", word);
+				return;
+			}
+			e->arg_type = type;
+		} else if (!strcmp(word, "suffix")) {
+			e->flags |= T_FLAG_SUFFIX_TOKEN_DELIM_INT;
+		} else if (!strncmp(word, "handler=", 8) && is_identifier(word + 8)) {
+			e->handler = xstrdup(word + 8);
+		} else if (!strncmp(word, "tokens=", 7) && is_identifier(word + 7)) {
+			e->sub_name = xstrdup(word + 7);
+		} else if (!strncmp(word, "enum=", 5) && keyword) {
+			name = word + 5;
+		} else {
+			error(line, "Unknown attribute %s.", word);
+			return;
+		}
+	}
+
+	if (keyword && (e->token = add_keyword(keyword, name, line)) == -1)
+		e->token = 0;
+}
+
+static int parse(FILE *f)
+{
+	struct entry *e, *prev;
+	char buf[MAX_LINE], *s, *p, *name;
+	int stack[MAX_DEPTH], depth, prev_depth, line, t;
+
+	prev = NULL;
+	prev_depth = -1;
+	line = 0;
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		if ((p = strchr(buf, '\n')))
+			*p = 0;
+		else if (!feof(f))
+			error(line, "Line too long.", NULL);
+		if ((p = strchr(buf, '\r')))
+			*p = 0;
+		for (depth = 0; buf[depth] == '\t'; depth++)
+			;
+		s = buf + depth;
+		if (*s == ' ') {
+			for (p = s; *p == ' '; p++)
+				;
+			if (*p && *p != '#')
+				error(line, "Indent with tabs.", NULL);
+			continue;
+		}
+		if (!*s || *s == '#')
+			continue;
+
+		if (*s == '[') {
+			if (depth || !(p = strchr(s, ']')) || p[1]) {
+				error(line, "Invalid table name line.", NULL);
+				prev = NULL;
+				continue;
+			}
+			*p = 0;
+			name = s + 1;
+			if (!is_identifier(name)) {
+				error(line, "Invalid table name %s.", name);
+				prev = NULL;
+				continue;
+			}
+			t = add_table(name, TRUE, line);
+			stack[0] = t;
+			prev = NULL;
+			prev_depth = t == -1 ? -1 : 0;
+			continue;
+		}
+
+		if (prev_depth == -1) {
+			error(line, "Entry outside a table.", NULL);
+			continue;
+		}
+		if (depth >= MAX_DEPTH) {
+			error(line, "Nested too deeply.", NULL);
+			continue;
+		}
+		if (depth > prev_depth + (prev ? 1 : 0)) {
+			error(line, "Unexpected indent.", NULL);
+			continue;
+		}
+		if (prev && depth == prev_depth + 1) {
+			/* Start of the subtokens of the entry above. */
+			if (prev->sub_name) {
+				error(line, "Entry has both tokens= and subtokens.", NULL);
+				continue;
+			}
+			if (prev->token >= T_ARG_UINT || !prev->token) {
+				error(line, "Only keywords can have subtokens.", NULL);
+				continue;
+			}
+			name = keywords[prev->token].name;
+			if (!strncmp(name, "T_", 2))
+				name += 2;
+			snprintf(buf + sizeof(buf) / 2, sizeof(buf) / 2, "%s_%s",
+					tables[stack[depth - 1]].name, name);
+			for (p = buf + sizeof(buf) / 2; *p; p++)
+				*p = tolower((unsigned char)*p);
+			if ((t = add_table(buf + sizeof(buf) / 2, FALSE, line)) == -1)
+				continue;
+			prev->sub = t;
+			stack[depth] = t;
+		}
+		e = add_entry(stack[depth]);
+		parse_entry(e, s, line);
+		prev = e;
+		prev_depth = depth;
+	}
+
+	return !errors;
+}
+
+/* Resolve tokens= references and check every table. */
+static int check(void)
+{
+	struct table *table;
+	struct entry *e, *e2;
+	const char *s, *s2;
+	int t, i, j;
+
+	for (t = 0; t < num_tables; t++) {
+		table = &tables[t];
+		if (!table->num_entries)
+			error(table->line, "Table %s is empty.", table->name);
+		for (i = 0; i < table->num_entries; i++) {
+			e = &table->entries[i];
+			if (e->sub_name) {
+				if ((e->sub = find_table(e->sub_name)) == -1)
+					error(e->line, "Unknown table %s.", e->sub_name);
+			}
+			if (e->arg_type == T_ARG_TOKEN && e->sub == -1)
+				error(e->line, "Argument type <token> without subtokens.", NULL);
+			if (!e->token || e->token >= T_ARG_UINT)
+				continue;
+			s = keywords[e->token].str;
+			for (j = 0; j < table->num_entries; j++) {
+				e2 = &table->entries[j];
+				if (j == i || !e2->token || e2->token >= T_ARG_UINT)
+					continue;
+				s2 = keywords[e2->token].str;
+				if (e2->token == e->token) {
+					if (j < i)
+						error(e->line, "Duplicate keyword '%s'.", s);
+				} else if (!strncmp(s, s2, strlen(s))) {
+					warning(e->line, "'%s' is the start of '%s', so it "
+							"can't be abbreviated.", s, s2);
+				}
+			}
+		}
+	}
+
+	return !errors;
+}
+
+/* Set up the tables and dictionary as tokenline expects them. */
+static void build(void)
+{
+	struct table *table;
+	struct entry *e;
+	int t, i;
+
+	for (i = 1; i < num_keywords; i++) {
+		dict[i].token = i;
+		dict[i].tokenstr = keywords[i].str;
+	}
+	for (t = 0; t < num_tables; t++) {
+		table = &tables[t];
+		table->tokens = calloc(table->num_entries + 1, sizeof(t_token));
+		if (!table->tokens) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+	for (t = 0; t < num_tables; t++) {
+		table = &tables[t];
+		for (i = 0; i < table->num_entries; i++) {
+			e = &table->entries[i];
+			table->tokens[i].token = e->token;
+			table->tokens[i].arg_type = e->arg_type;
+			table->tokens[i].flags = e->flags;
+			if (e->sub != -1)
+				table->tokens[i].subtokens = tables[e->sub].tokens;
+		}
+	}
+}
+
+static int index_tables(void)
+{
+	int t;
+
+	tl_index_init(&token_index, dict);
+	for (t = 0; t < num_tables; t++) {
+		if (tables[t].exported && !tl_index_add(&token_index, tables[t].tokens)) {
+			error(tables[t].line, "Index is full at table %s; raise the "
+					"TL_MAX_INDEX_* limits.", tables[t].name);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void print_chars(FILE *f, const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', f);
+		fputc(*s, f);
+	}
+}
+
+static void write_table(FILE *f, int t)
+{
+	struct table *table;
+	struct entry *e;
+	int i;
+
+	table = &tables[t];
+	if (table->emitted)
+		return;
+	table->emitted = TRUE;
+
+	/* Static tables need to be defined before they're referenced. */
+	for (i = 0; i < table->num_entries; i++) {
+		e = &table->entries[i];
+		if (e->sub != -1 && !tables[e->sub].exported)
+			write_table(f, e->sub);
+	}
+
+	fprintf(f, "%sconst t_token %s[] = {\n", table->exported ? "" : "static ",
+			table->name);
+	for (i = 0; i < table->num_entries; i++) {
+		e = &table->entries[i];
+		fprintf(f, "\t{ %s", token_name(e->token));
+		if (e->arg_type)
+			fprintf(f, ",\n\t\t.arg_type = %s", token_name(e->arg_type));
+		if (e->flags)
+			fprintf(f, ",\n\t\t.flags = T_FLAG_SUFFIX_TOKEN_DELIM_INT");
+		if (e->sub != -1)
+			fprintf(f, ",\n\t\t.subtokens = %s", tables[e->sub].name);
+		if (e->help)
+			fprintf(f, ",\n\t\t.help = \"%s\"", e->help);
+		if (e->help_full)
+			fprintf(f, ",\n\t\t.help_full = \"%s\"", e->help_full);
+		if (e->handler)
+			fprintf(f, ",\n\t\t.handler = %s", e->handler);
+		fprintf(f, " },\n");
+	}
+	fprintf(f, "\t{ }\n};\n\n");
+}
+
+static const char *table_name(const t_token *tokens)
+{
+	int t;
+
+	for (t = 0; t < num_tables; t++) {
+		if (tables[t].tokens == tokens)
+			return tables[t].name;
+	}
+
+	return NULL;
+}
+
+/*
+ * The index is emitted as arrays sized to the tables, named after it, and
+ * the t_token_index pointing at them.
+ */
+static void write_index(FILE *f, const char *index_name, const char *dict_name)
+{
+	const t_token_index_table *table;
+	const t_token_index_entry *e;
+	int t, i;
+
+	if (token_index.num_tables) {
+		fprintf(f, "static const t_token_index_table %s_tables[] = {\n",
+				index_name);
+		for (t = 0; t < token_index.num_tables; t++) {
+			table = &token_index.tables[t];
+			fprintf(f, "\t{ %s, %d, %d, %d, %d },\n",
+					table_name(table->tokens), table->start,
+					table->count, table->arg_uint, table->arg_string);
+		}
+		fprintf(f, "};\n\n");
+	}
+	if (token_index.num_entries) {
+		fprintf(f, "static const t_token_index_entry %s_entries[] = {\n",
+				index_name);
+		for (t = 0; t < token_index.num_tables; t++) {
+			table = &token_index.tables[t];
+			fprintf(f, "\t/* %s */\n", table_name(table->tokens));
+			for (i = 0; i < table->count; i++) {
+				e = &token_index.entries[table->start + i];
+				fprintf(f, "\t{ %s, %d, %d, %d },\n", token_name(e->token),
+						e->pos, e->keyword, e->len);
+			}
+		}
+		fprintf(f, "};\n\n");
+	}
+	if (token_index.keywords_len) {
+		fprintf(f, "static const char %s_keywords[] =", index_name);
+		for (i = 0; i < token_index.keywords_len;
+				i += strlen(token_index.keywords + i) + 1) {
+			/* Each keyword ends its own literal, so nothing can follow \0. */
+			fprintf(f, "\n\t\"");
+			print_chars(f, token_index.keywords + i);
+			fprintf(f, "\\0\"");
+		}
+		fprintf(f, ";\n\n");
+	}
+	if (token_index.num_special > 0) {
+		fprintf(f, "static const uint16_t %s_special[] = {\n\t", index_name);
+		for (i = 0; i < token_index.num_special; i++)
+			fprintf(f, "%s%s,", i ? " " : "", token_name(token_index.special[i]));
+		fprintf(f, "\n};\n\n");
+	}
+
+	fprintf(f, "const t_token_index %s = {\n", index_name);
+	fprintf(f, "\t.token_dict = %s,\n", dict_name);
+	fprintf(f, "\t.num_tables = %d,\n", token_index.num_tables);
+	fprintf(f, "\t.num_entries = %d,\n", token_index.num_entries);
+	if (token_index.num_tables)
+		fprintf(f, "\t.tables = %s_tables,\n", index_name);
+	if (token_index.num_entries)
+		fprintf(f, "\t.entries = %s_entries,\n", index_name);
+	fprintf(f, "\t.keywords_len = %d,\n", token_index.keywords_len);
+	if (token_index.keywords_len)
+		fprintf(f, "\t.keywords = %s_keywords,\n", index_name);
+	fprintf(f, "\t.num_special = %d,\n", token_index.num_special);
+	if (token_index.num_special > 0)
+		fprintf(f, "\t.special = %s_special,\n", index_name);
+	fprintf(f, "};\n");
+}
+
+static const char *base_name(const char *path)
+{
+	const char *s;
+
+	return (s = strrchr(path, '/')) ? s + 1 : path;
+}
+
+static int write_header(const char *path, const char *index_name,
+		const char *dict_name)
+{
+	FILE *f;
+	const char *s;
+	int i;
+
+	if (!(f = fopen(path, "w"))) {
+		perror(path);
+		return FALSE;
+	}
+	fprintf(f, "/* Generated by tokenline-gen from %s, do not edit. */\n\n",
+			input_name);
+	fprintf(f, "#ifndef ");
+	for (s = base_name(path); *s; s++)
+		fputc(isalnum((unsigned char)*s) ? toupper((unsigned char)*s) : '_', f);
+	fprintf(f, "\n#define ");
+	for (s = base_name(path); *s; s++)
+		fputc(isalnum((unsigned char)*s) ? toupper((unsigned char)*s) : '_', f);
+	fprintf(f, "\n\n#include \"tokenline.h\"\n\n");
+
+	fprintf(f, "enum {\n");
+	for (i = 1; i < num_keywords; i++)
+		fprintf(f, "\t%s%s,\n", keywords[i].name, i == 1 ? " = 1" : "");
+	fprintf(f, "};\n\n");
+
+	fprintf(f, "extern const t_token_dict %s[];\n", dict_name);
+	for (i = 0; i < num_tables; i++) {
+		if (tables[i].exported)
+			fprintf(f, "extern const t_token %s[];\n", tables[i].name);
+	}
+	fprintf(f, "extern const t_token_index %s;\n\n", index_name);
+	fprintf(f, "#endif\n");
+
+	return !fclose(f);
+}
+
+/* Does an entry before entry i of table t have the same handler? */
+static int handler_declared(int t, int i)
+{
+	struct entry *e;
+	int t2, i2;
+
+	for (t2 = 0; t2 <= t; t2++) {
+		for (i2 = 0; i2 < (t2 == t ? i : tables[t2].num_entries); i2++) {
+			e = &tables[t2].entries[i2];
+			if (e->handler && !strcmp(e->handler, tables[t].entries[i].handler))
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static int write_source(const char *path, const char *header,
+		const char *index_name, const char *dict_name)
+{
+	FILE *f;
+	struct entry *e;
+	int t, i, k;
+
+	if (!(f = fopen(path, "w"))) {
+		perror(path);
+		return FALSE;
+	}
+	fprintf(f, "/* Generated by tokenline-gen from %s, do not edit. */\n\n",
+			input_name);
+	fprintf(f, "#include \"tokenline.h\"\n");
+	fprintf(f, "#include \"%s\"\n\n", base_name(header));
+
+	/* Handler prototypes, each once. */
+	k = 0;
+	for (t = 0; t < num_tables; t++) {
+		for (i = 0; i < tables[t].num_entries; i++) {
+			e = &tables[t].entries[i];
+			if (e->handler && !handler_declared(t, i)) {
+				fprintf(f, "void %s(void *user, t_tokenline_parsed *p);\n",
+						e->handler);
+				k++;
+			}
+		}
+	}
+	if (k)
+		fprintf(f, "\n");
+
+	fprintf(f, "const t_token_dict %s[] = {\n", dict_name);
+	fprintf(f, "\t{ /* Dummy entry */ },\n");
+	for (i = 1; i < num_keywords; i++) {
+		fprintf(f, "\t{ %s, \"", keywords[i].name);
+		print_chars(f, keywords[i].str);
+		fprintf(f, "\" },\n");
+	}
+	fprintf(f, "\t{ }\n};\n\n");
+
+	for (t = 0; t < num_tables; t++) {
+		if (tables[t].exported)
+			write_table(f, t);
+	}
+
+	write_index(f, index_name, dict_name);
+
+	return !fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	const char *dict_name, *index_name;
+	int i;
+
+	dict_name = "dict";
+	index_name = "token_index";
+	for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		if (!strcmp(argv[i], "-d") && is_identifier(argv[i + 1]))
+			dict_name = argv[i + 1];
+		else if (!strcmp(argv[i], "-i") && is_identifier(argv[i + 1]))
+			index_name = argv[i + 1];
+		else
+			break;
+	}
+	if (argc - i != 3) {
+		fprintf(stderr, "Usage: tokenline-gen [-d dict] [-i index] input.tl "
+				"output.c output.h\n");
+		return 1;
+	}
+
+	input_name = argv[i];
+	if (!(f = fopen(input_name, "r"))) {
+		perror(input_name);
+		return 1;
+	}
+	parse(f);
+	fclose(f);
+	if (errors || !check())
+		return 1;
+	build();
+	if (!index_tables())
+		return 1;
+
+	if (!write_header(argv[i + 2], index_name, dict_name)
+			|| !write_source(argv[i + 1], argv[i + 2], index_name, dict_name)) {
+		remove(argv[i + 1]);
+		remove(argv[i + 2]);
+		return 1;
+	}
+
+	return 0;
+}